@@ -5,7 +5,12 @@ namespace libsesame3bt::core {
 
 using model_t = Sesame::model_t;
 
-SesameClientCore::SesameClientCore(SesameBLEBackend& backend) : impl(std::make_unique<SesameClientCoreImpl>(backend, *this)) {}
+/// @brief Constructor
+/// @param backend BLE backend
+/// @param tx_queue_size send queue size in bytes, must hold the largest message sent.
+/// 0: no queue, a message fails when the backend rejects a write.
+SesameClientCore::SesameClientCore(SesameBLEBackend& backend, size_t tx_queue_size)
+    : impl(std::make_unique<SesameClientCoreImpl>(backend, *this, tx_queue_size)) {}
 
 SesameClientCore::~SesameClientCore() {}
 
@@ -61,6 +66,18 @@ SesameClientCore::on_received(const std::byte* data, size_t size) {
 	impl->on_received(data, size);
 }
 
+/**
+ * @brief Handle multiple received notifications at once.
+ * Same as calling on_received() for each notification, callbacks are fired in order.
+ *
+ * @param packets notifications (in received order)
+ * @param count number of notifications
+ */
+void
+SesameClientCore::on_received_batch(const rx_packet_t* packets, size_t count) {
+	impl->on_received_batch(packets, count);
+}
+
 /**
  * @brief Process after disconnected.
  *
@@ -70,6 +87,60 @@ SesameClientCore::on_disconnected() {
 	impl->on_disconnected();
 }
 
+/**
+ * @brief Process after ATT MTU exchanged.
+ * Messages to SESAME are split into (mtu - 4) bytes fragments instead of the default 19 bytes.
+ * @note Reset to the default on disconnect. Call after each connection if needed.
+ *
+ * @param mtu negotiated ATT MTU
+ */
+void
+SesameClientCore::on_mtu_changed(uint16_t mtu) {
+	impl->on_mtu_changed(mtu);
+}
+
+/**
+ * @brief Process when the BLE stack can accept writes again.
+ * Fragments not accepted by SesameBLEBackend::write_fragments_to_tx() are queued and sent by this.
+ * Queued fragments are also sent before the next command.
+ *
+ * @return true All queued fragments sent
+ * @return false Fragments remaining
+ */
+bool
+SesameClientCore::on_tx_ready() {
+	return impl->on_tx_ready();
+}
+
+/**
+ * @brief Number of fragments waiting in the send queue
+ *
+ * @return size_t
+ */
+size_t
+SesameClientCore::get_tx_queue_depth() const {
+	return impl->get_tx_queue_depth();
+}
+
+/**
+ * @brief Transport counters (accumulated across connections)
+ *
+ * @return const transport_stats_t&
+ */
+const transport_stats_t&
+SesameClientCore::get_transport_stats() const {
+	return impl->get_transport_stats();
+}
+
+/**
+ * @brief Clear transport counters
+ *
+ */
+void
+SesameClientCore::reset_transport_stats() {
+	impl->reset_transport_stats();
+}
+
 /**
  * @brief Unlock SESAME.
  *
@@ -259,6 +330,100 @@ SesameClientCore::request_status() {
 	return impl->request_status();
 }
 
+/**
+ * @brief Set IV resynchronization window
+ * When a received message fails to authenticate, up to `window` following IVs are tried
+ * (recover from lost messages without reconnecting).
+ * @note Disabled (0) by default. Each extra IV tried raises the chance of accepting a forged message.
+ *
+ * @param window number of IVs to try
+ */
+void
+SesameClientCore::set_iv_resync_window(uint8_t window) {
+	impl->set_iv_resync_window(window);
+}
+
+/**
+ * @brief Number of IV resynchronizations happened
+ *
+ * @return uint32_t
+ */
+uint32_t
+SesameClientCore::get_iv_resync_count() const {
+	return impl->get_iv_resync_count();
+}
+
+/**
+ * @brief Precompute AES-CCM key stream of the next messages
+ * When enabled, update() computes the key stream for the next sent and received messages in advance,
+ * leaving only CBC-MAC and XOR to the time a message is sent or received. Disabled by default.
+ *
+ * @param enable
+ */
+void
+SesameClientCore::set_keystream_precompute(bool enable) {
+	impl->set_keystream_precompute(enable);
+}
+
+/**
+ * @brief Advance SESAME 3 / 4 / bot login handshake from update() instead of on_received()
+ * Key pair generation and ECDH are done in slices, one slice per update() call, and the login is sent when done.
+ * A slice is bounded by LIBSESAME3BTCORE_ECP_MAX_OPS when Mbed TLS is built with MBEDTLS_ECP_RESTARTABLE,
+ * otherwise it is one whole operation. Disabled by default (handshake completes in on_received()).
+ *
+ * @param enable
+ */
+void
+SesameClientCore::set_restartable_handshake(bool enable) {
+	impl->set_restartable_handshake(enable);
+}
+
+/**
+ * @brief Precompute SESAME 3 / 4 / bot login handshake material in update()
+ * Key pair, ECDH and the leading CMAC blocks of up to LIBSESAME3BTCORE_OS2_HANDSHAKE_POOL_SIZE logins are computed
+ * in advance (in slices with set_restartable_handshake()), a login then costs a few AES blocks. Each material is used once.
+ * Disabled by default.
+ *
+ * @param enable
+ */
+void
+SesameClientCore::set_handshake_precompute(bool enable) {
+	impl->set_handshake_precompute(enable);
+}
+
+/**
+ * @brief Reuse key pair and ECDH result of SESAME 3 / 4 / bot login on reconnection
+ * Up to max_reuse following logins skip ECC and derive only the session key (with a new random token).
+ * This trades forward secrecy between these connections for login latency. Disabled by default (0).
+ *
+ * @param max_reuse Number of logins reusing one ECDH result
+ * @param lifetime_msec Milliseconds an ECDH result is reused since its first login (0: no limit).
+ * Other than 0 requires SesameBLEBackend::get_time_ms(), without it the ECDH result is not reused.
+ */
+void
+SesameClientCore::set_shared_secret_reuse(uint16_t max_reuse, uint32_t lifetime_msec) {
+	impl->set_shared_secret_reuse(max_reuse, lifetime_msec);
+}
+
+/**
+ * @brief Number of logins done with a reused ECDH result
+ *
+ * @return uint32_t
+ */
+uint32_t
+SesameClientCore::get_shared_secret_reuse_count() const {
+	return impl->get_shared_secret_reuse_count();
+}
+
+/**
+ * @brief Do background work (login handshake, precompute handshake material and key stream), call it when idle
+ *
+ */
+void
+SesameClientCore::update() {
+	impl->update();
+}
+
 /**
  * @brief Convert voltage to estimated battery remaining
  *
@@ -22,13 +22,17 @@ using util::to_ptr;
 
 using model_t = Sesame::model_t;
 
-SesameClientCoreImpl::SesameClientCoreImpl(SesameBLEBackend& backend, SesameClientCore& core) : transport(backend), core(core) {}
+SesameClientCoreImpl::SesameClientCoreImpl(SesameBLEBackend& backend, SesameClientCore& core, size_t tx_queue_size)
+    : transport(backend, recv_storage, tx_queue_size), core(core) {}
 
 SesameClientCoreImpl::~SesameClientCoreImpl() {}
 
 void
 SesameClientCoreImpl::disconnect() {
 	transport.disconnect();
+	if (handler) {
+		handler->reset();
+	}
 	if (crypt) {
 		crypt->reset_session_key();
 	}
@@ -43,16 +47,18 @@ SesameClientCoreImpl::begin(model_t model) {
 	switch (os) {
 		case Sesame::os_ver_t::os2:
 			crypt.emplace(std::in_place_type<OS2IVHandler>);
-			handler.emplace(std::in_place_type<OS2Handler>, this, transport, *crypt);
+			handler.emplace(std::in_place_type<OS2Handler>, this, transport, crypt->get<OS2IVHandler, crypt_role_t::central>());
 			break;
 		case Sesame::os_ver_t::os3:
 			crypt.emplace(std::in_place_type<OS3IVHandler>);
-			handler.emplace(std::in_place_type<OS3Handler>, this, transport, *crypt);
+			handler.emplace(std::in_place_type<OS3Handler>, this, transport, crypt->get<OS3IVHandler, crypt_role_t::central>());
 			break;
 		default:
 			DEBUG_PRINTF("%u: model not supported\n", static_cast<uint8_t>(model));
 			return false;
 	}
+	crypt->set_resync_window(iv_resync_window);
+	crypt->set_keystream_storage(keystreams.get());
 	if (!handler->init()) {
 		handler.reset();
 		return false;
@@ -60,6 +66,37 @@ SesameClientCoreImpl::begin(model_t model) {
 	return true;
 }
 
+void
+SesameClientCoreImpl::set_iv_resync_window(uint8_t window) {
+	iv_resync_window = window;
+	if (crypt) {
+		crypt->set_resync_window(window);
+	}
+}
+
+void
+SesameClientCoreImpl::set_keystream_precompute(bool enable) {
+	if (enable && !keystreams) {
+		keystreams = std::make_unique<keystream_pair_t>();
+	}
+	if (crypt) {
+		crypt->set_keystream_storage(enable ? keystreams.get() : nullptr);
+	}
+	if (!enable) {
+		keystreams.reset();
+	}
+}
+
+void
+SesameClientCoreImpl::update() {
+	if (handler) {
+		handler->update();
+	}
+	if (crypt && is_session_active()) {
+		crypt->precompute_keystream();
+	}
+}
+
 bool
 SesameClientCoreImpl::set_keys(std::string_view pk_str, std::string_view secret_str) {
 	if (!handler) {
@@ -91,6 +128,12 @@ SesameClientCoreImpl::update_state(state_t new_state) {
 
 void
 SesameClientCoreImpl::on_received(const std::byte* p, size_t len) {
+	rx_packet_t packet{p, len};
+	on_received_batch(&packet, 1);
+}
+
+void
+SesameClientCoreImpl::on_received_batch(const rx_packet_t* packets, size_t count) {
 	if (!handler) {
 		DEBUG_PRINTLN("begin() not finished");
 		return;
@@ -99,72 +142,75 @@ SesameClientCoreImpl::on_received(const std::byte* p, size_t len) {
 		DEBUG_PRINTLN("Keys are not set");
 		return;
 	}
-	auto rc = transport.decode(p, len, *crypt);
-	if (rc != SesameBLETransport::decode_result_t::received) {
-		return;
+	for (size_t i = 0; i < count; i++) {
+		if (transport.decode(packets[i].data, packets[i].size, *crypt) == SesameBLETransport::decode_result_t::received) {
+			handle_message();
+		}
 	}
-	auto recv_size = transport.data_size();
-	if (recv_size < sizeof(Sesame::message_header_t)) {
+}
+
+void
+SesameClientCoreImpl::handle_message() {
+	MessageView msg{transport.data(), transport.data_size()};
+	const auto* header = msg.as<Sesame::message_header_t>();
+	if (!header) {
 		DEBUG_PRINTLN("too short message dropped");
 		return;
 	}
-	auto* msg = reinterpret_cast<const Sesame::message_header_t*>(transport.data());
-	auto* body = transport.data() + sizeof(Sesame::message_header_t);
-	switch (msg->op_code) {
+	auto body = msg.after<Sesame::message_header_t>();
+	switch (header->op_code) {
 		case Sesame::op_code_t::publish:
-			switch (msg->item_code) {
+			switch (header->item_code) {
 				case Sesame::item_code_t::initial:
-					handle_publish_initial();
+					handle_publish_initial(body);
 					break;
 				case Sesame::item_code_t::mech_setting:
-					handler->handle_publish_mecha_setting(body, recv_size - sizeof(Sesame::message_header_t));
+					handler->handle_publish_mecha_setting(body);
 					break;
 				case Sesame::item_code_t::mech_status:
-					handler->handle_publish_mecha_status(body, recv_size - sizeof(Sesame::message_header_t));
+					handler->handle_publish_mecha_status(body);
 					break;
 				case Sesame::item_code_t::pub_ssm_key:
-					handle_publish_pub_key_sesame(body, recv_size - sizeof(Sesame::message_header_t));
+					handle_publish_pub_key_sesame(body);
 					break;
 				default:
-					DEBUG_PRINTLN("%u: Unsupported item on publish: %s", static_cast<uint8_t>(msg->item_code),
-					              util::bin2hex(transport.data() + 1, transport.data_size() - 1).c_str());
+					DEBUG_PRINTLN("%u: Unsupported item on publish: %s", static_cast<uint8_t>(header->item_code),
+					              util::bin2hex(msg.data() + 1, msg.size() - 1).c_str());
 					break;
 			}
 			break;
 		case Sesame::op_code_t::response:
-			switch (msg->item_code) {
+			switch (header->item_code) {
 				case Sesame::item_code_t::login:
-					handler->handle_response_login(transport.data() + sizeof(Sesame::message_header_t),
-					                               transport.data_size() - sizeof(Sesame::message_header_t));
+					handler->handle_response_login(body);
 					break;
 				case Sesame::item_code_t::mech_status:
-					handler->handle_response_mecha_status(body, recv_size - sizeof(Sesame::message_header_t));
+					handler->handle_response_mecha_status(body);
 					break;
 				case Sesame::item_code_t::history:
 					if (history_callback) {
-						handler->handle_history(body, recv_size - sizeof(Sesame::message_header_t));
+						handler->handle_history(body);
 					}
 					break;
 				default:
-					DEBUG_PRINTLN("%u: Unsupported item on response: %s", static_cast<uint8_t>(msg->item_code),
-					              util::bin2hex(transport.data() + 1, transport.data_size() - 1).c_str());
+					DEBUG_PRINTLN("%u: Unsupported item on response: %s", static_cast<uint8_t>(header->item_code),
+					              util::bin2hex(msg.data() + 1, msg.size() - 1).c_str());
 					break;
 			}
 			break;
 		default:
-			DEBUG_PRINTLN("%u: Unexpected op code", static_cast<uint8_t>(msg->op_code));
+			DEBUG_PRINTLN("%u: Unexpected op code", static_cast<uint8_t>(header->op_code));
 			break;
 	}
 }
 
 void
-SesameClientCoreImpl::handle_publish_initial() {
+SesameClientCoreImpl::handle_publish_initial(MessageView body) {
 	if (get_state() == state_t::authenticating) {
 		DEBUG_PRINTLN("skipped repeating initial");
 		return;
 	}
-	handler->handle_publish_initial(transport.data() + sizeof(Sesame::message_header_t),
-	                                transport.data_size() - sizeof(Sesame::message_header_t));
+	handler->handle_publish_initial(body);
 	return;
 }
 
@@ -306,6 +352,9 @@ SesameClientCoreImpl::fire_status_callback() {
 void
 SesameClientCoreImpl::on_disconnected() {
 	transport.reset();
+	if (handler) {
+		handler->reset();
+	}
 	if (crypt) {
 		crypt->reset_session_key();
 	}
@@ -348,14 +397,14 @@ SesameClientCoreImpl::request_status() {
 }
 
 void
-SesameClientCoreImpl::handle_publish_pub_key_sesame(const std::byte* in, size_t in_size) {
+SesameClientCoreImpl::handle_publish_pub_key_sesame(MessageView body) {
 	if (!registered_devices_callback) {
 		return;
 	}
-	int ndevices = in_size / REGISTERED_DEVICE_DATA_SIZE;
+	int ndevices = body.size() / REGISTERED_DEVICE_DATA_SIZE;
 	auto regs = std::vector<RegisteredDevice>();
 	for (auto i = 0; i < ndevices; i++) {
-		const auto* top = in + REGISTERED_DEVICE_DATA_SIZE * i;
+		const auto* top = body.data() + REGISTERED_DEVICE_DATA_SIZE * i;
 		if (top[22] == std::byte{0}) {
 			continue;
 		}
@@ -4,6 +4,7 @@
 #include <atomic>
 #include <cstddef>
 #include <ctime>
+#include <memory>
 #include <optional>
 #include <string_view>
 #include <utility>
@@ -11,8 +12,13 @@
 #include "api_wrapper.h"
 #include "crypt.h"
 #include "handler.h"
+#include "message.h"
 #include "libsesame3bt/ClientCore.h"
 
+#ifndef LIBSESAME3BTCORE_CLIENT_RECV_SIZE
+#define LIBSESAME3BTCORE_CLIENT_RECV_SIZE 256
+#endif
+
 namespace libsesame3bt::core {
 
 /**
@@ -24,8 +30,11 @@ class SesameClientCoreImpl {
 	static constexpr size_t MAX_CMD_TAG_SIZE_OS2 = 21;
 	static constexpr size_t MAX_CMD_TAG_SIZE_OS3 = 29;
 	static constexpr size_t MAX_HISTORY_TAG_SIZE = std::max(MAX_CMD_TAG_SIZE_OS2, MAX_CMD_TAG_SIZE_OS3);
+	static constexpr size_t MAX_RECV = LIBSESAME3BTCORE_CLIENT_RECV_SIZE;
+	static_assert(MAX_RECV >= sizeof(Sesame::message_header_t) + sizeof(Sesame::response_login_t) + CryptHandler::CMAC_TAG_SIZE,
+	              "LIBSESAME3BTCORE_CLIENT_RECV_SIZE too small");
 
-	SesameClientCoreImpl(SesameBLEBackend& backend, SesameClientCore& core);
+	SesameClientCoreImpl(SesameBLEBackend& backend, SesameClientCore& core, size_t tx_queue_size);
 	SesameClientCoreImpl(const SesameClientCoreImpl&) = delete;
 	SesameClientCoreImpl& operator=(const SesameClientCoreImpl&) = delete;
 	virtual ~SesameClientCoreImpl();
@@ -34,7 +43,13 @@ class SesameClientCoreImpl {
 	              const std::array<std::byte, Sesame::SECRET_SIZE>& secret_key);
 	bool set_keys(std::string_view pk_str, std::string_view secret_str);
 	void on_received(const std::byte*, size_t);
+	void on_received_batch(const rx_packet_t* packets, size_t count);
 	void on_disconnected();
+	void on_mtu_changed(uint16_t mtu) { transport.set_mtu(mtu); }
+	bool on_tx_ready() { return transport.flush(); }
+	size_t get_tx_queue_depth() const { return transport.get_queue_depth(); }
+	const transport_stats_t& get_transport_stats() const { return transport.get_stats(); }
+	void reset_transport_stats() { transport.reset_stats(); }
 	bool unlock(std::string_view tag);
 	bool unlock(history_tag_type_t type, const std::array<std::byte, HISTORY_TAG_UUID_SIZE>& uuid);
 	bool lock(std::string_view tag);
@@ -54,6 +69,17 @@ class SesameClientCoreImpl {
 	bool has_setting() const;
 	bool request_status();
 	bool is_key_set() const { return _is_key_set; }
+	void set_iv_resync_window(uint8_t window);
+	uint32_t get_iv_resync_count() const { return crypt ? crypt->get_resync_count() : 0; }
+	void set_keystream_precompute(bool enable);
+	void set_restartable_handshake(bool enable) { restartable_handshake = enable; }
+	void set_handshake_precompute(bool enable) { handshake_precompute = enable; }
+	void set_shared_secret_reuse(uint16_t max_reuse, uint32_t lifetime_msec) {
+		secret_reuse_max = max_reuse;
+		secret_reuse_lifetime = lifetime_msec;
+	}
+	uint32_t get_shared_secret_reuse_count() const { return secret_reuse_count; }
+	void update();
 
  private:
 	friend class OS2Handler;
@@ -67,15 +93,24 @@ class SesameClientCoreImpl {
 	history_callback_t history_callback{};
 	registered_devices_callback_t registered_devices_callback{};
 	Sesame::model_t model;
+	std::array<std::byte, MAX_RECV> recv_storage;
 	SesameBLETransport transport;
+	std::unique_ptr<keystream_pair_t> keystreams;  // allocated while precompute is enabled
 	std::optional<CryptHandler> crypt;
 	std::optional<Handler> handler;
 
 	bool _is_key_set = false;
+	uint8_t iv_resync_window = 0;
+	bool restartable_handshake = false;
+	bool handshake_precompute = false;
+	uint16_t secret_reuse_max = 0;
+	uint32_t secret_reuse_lifetime = 0;
+	uint32_t secret_reuse_count = 0;
 
 	SesameClientCore& core;
 
-	void handle_publish_initial();
+	void handle_message();
+	void handle_publish_initial(MessageView body);
 	void fire_status_callback();
 	void update_state(state_t new_state);
 	void fire_history_callback(const History& history);
@@ -83,7 +118,7 @@ class SesameClientCoreImpl {
 	bool send_cmd_with_uuid_tag(Sesame::item_code_t code,
 	                            history_tag_type_t type,
 	                            const std::array<std::byte, HISTORY_TAG_UUID_SIZE>& uuid);
-	void handle_publish_pub_key_sesame(const std::byte* in, size_t in_size);
+	void handle_publish_pub_key_sesame(MessageView body);
 };
 
 }  // namespace libsesame3bt::core
@@ -29,8 +29,15 @@ SesameServerCore::uuid_to_ble_address(const std::byte (&uuid)[16]) {
 	return std::array<std::byte, 6>{out[5] | std::byte{0xC0}, out[4], out[3], out[2], out[1], out[0]};
 }
 
-SesameServerCore::SesameServerCore(ServerBLEBackend& backend, int max_sessions)
-    : impl(std::make_unique<SesameServerCoreImpl>(backend, *this, max_sessions)) {}
+/// @brief Constructor
+/// @param backend BLE backend
+/// @param max_sessions maximum number of concurrent sessions
+/// @param recv_buffers number of receive buffers shared by sessions (0: same as max_sessions).
+/// A session uses a buffer only while receiving multi-fragment message or handling encrypted message.
+/// @param tx_queue_size send queue size in bytes of each session, must hold the largest message sent.
+/// 0: no queue, a message fails when the backend rejects a write.
+SesameServerCore::SesameServerCore(ServerBLEBackend& backend, int max_sessions, int recv_buffers, size_t tx_queue_size)
+    : impl(std::make_unique<SesameServerCoreImpl>(backend, *this, max_sessions, recv_buffers, tx_queue_size)) {}
 
 SesameServerCore::~SesameServerCore() {}
 
@@ -54,11 +61,63 @@ SesameServerCore::on_received(uint16_t session_id, const std::byte* data, size_t
 	return impl->on_received(session_id, data, size);
 }
 
+/// @brief Handle multiple received data of the session at once
+/// @note Same as calling on_received() for each data, callbacks are fired in order. Stops if the session is cleared by a callback.
+/// @param session_id
+/// @param packets received data (in received order)
+/// @param count number of data
+/// @return false if session not exists or any command failed
+bool
+SesameServerCore::on_received_batch(uint16_t session_id, const rx_packet_t* packets, size_t count) {
+	return impl->on_received_batch(session_id, packets, count);
+}
+
 void
 SesameServerCore::on_disconnected(uint16_t session_id) {
 	impl->on_disconnected(session_id);
 }
 
+/// @brief Notify ATT MTU of the session
+/// @note Call after on_subscribed(). Responses (registration, etc) are split into (mtu - 4) bytes fragments instead of the default 19 bytes.
+/// @param session_id
+/// @param mtu negotiated ATT MTU
+/// @return false if session not exists
+bool
+SesameServerCore::on_mtu_changed(uint16_t session_id, uint16_t mtu) {
+	return impl->on_mtu_changed(session_id, mtu);
+}
+
+/// @brief Send queued fragments of the session
+/// @note Call when the BLE stack can accept notifications again. Queued fragments are also retried in update().
+/// @param session_id
+/// @return true if all queued fragments sent
+bool
+SesameServerCore::on_tx_ready(uint16_t session_id) {
+	return impl->on_tx_ready(session_id);
+}
+
+/// @brief Number of fragments waiting in the send queue of the session
+/// @param session_id
+/// @return 0 if session not exists
+size_t
+SesameServerCore::get_tx_queue_depth(uint16_t session_id) const {
+	return impl->get_tx_queue_depth(session_id);
+}
+
+/// @brief Transport counters
+/// @param session_id session to query, all sessions (including disconnected ones) if omitted
+/// @return all zero if session not exists
+transport_stats_t
+SesameServerCore::get_transport_stats(std::optional<uint16_t> session_id) const {
+	return impl->get_transport_stats(session_id);
+}
+
+/// @brief Clear transport counters of all sessions
+void
+SesameServerCore::reset_transport_stats() {
+	impl->reset_transport_stats();
+}
+
 void
 SesameServerCore::set_on_registration_callback(registration_callback_t callback) {
 	impl->set_on_registration_callback(callback);
@@ -101,6 +160,30 @@ SesameServerCore::set_auto_send_flags(auto_send::flags flags) {
 	impl->set_auto_send_flags(flags);
 }
 
+/// @brief Set IV resynchronization window
+/// @note When a received message fails to authenticate, up to `window` following IVs are tried. Disabled (0) by default.
+/// Each extra IV tried raises the chance of accepting a forged message.
+/// @param window number of IVs to try
+void
+SesameServerCore::set_iv_resync_window(uint8_t window) {
+	impl->set_iv_resync_window(window);
+}
+
+/// @brief Number of IV resynchronizations happened (all sessions)
+/// @return
+uint32_t
+SesameServerCore::get_iv_resync_count() const {
+	return impl->get_iv_resync_count();
+}
+
+/// @brief Precompute AES-CCM key stream of the next messages of each session in update()
+/// @note Only CBC-MAC and XOR are left when a message is sent or received. Disabled by default.
+/// @param enable
+void
+SesameServerCore::set_keystream_precompute(bool enable) {
+	impl->set_keystream_precompute(enable);
+}
+
 std::tuple<std::string, std::string>
 SesameServerCore::create_advertisement_data_os3() const {
 	return impl->create_advertisement_data_os3();
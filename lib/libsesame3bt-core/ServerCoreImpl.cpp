@@ -13,7 +13,6 @@ namespace {
 
 constexpr size_t CMAC_TAG_SIZE = 4;
 constexpr size_t AES_KEY_SIZE = 16;
-constexpr size_t FRAGMENT_SIZE = 19;
 constexpr size_t AUTH_TAG_TRUNCATED_SIZE = 4;
 constexpr size_t KEY_INDEX_SIZE = 2;
 constexpr size_t ADD_DATA_SIZE = 1;
@@ -33,8 +32,17 @@ using util::to_byte;
 using util::to_cptr;
 using util::to_ptr;
 
-SesameServerCoreImpl::SesameServerCoreImpl(ServerBLEBackend& backend, SesameServerCore& core, size_t max_sessions)
-    : core(core), ble_backend(backend), vsessions(max_sessions) {}
+SesameServerCoreImpl::SesameServerCoreImpl(ServerBLEBackend& backend,
+                                           SesameServerCore& core,
+                                           size_t max_sessions,
+                                           size_t recv_buffers,
+                                           size_t tx_queue_size)
+    : core(core),
+      ble_backend(backend),
+      recv_pool(recv_buffers > 0 ? std::min(recv_buffers, max_sessions) : max_sessions, ServerSession::MAX_RECV),
+      tx_queue_size(tx_queue_size),
+      tx_storage(max_sessions * tx_queue_size),
+      vsessions(max_sessions) {}
 
 bool
 SesameServerCoreImpl::begin(Sesame::model_t model, const uint8_t (&uuid)[16]) {
@@ -78,20 +86,38 @@ SesameServerCoreImpl::on_subscribed(uint16_t session_id) {
 
 bool
 SesameServerCoreImpl::on_received(uint16_t session_id, const std::byte* data, size_t size) {
+	rx_packet_t packet{data, size};
+	return on_received_batch(session_id, &packet, 1);
+}
+
+bool
+SesameServerCoreImpl::on_received_batch(uint16_t session_id, const rx_packet_t* packets, size_t count) {
 	auto* session = get_session(session_id);
 	if (session == nullptr) {
 		DEBUG_PRINTLN("Session %u not found", session_id);
 		return false;
 	}
 	using decode_result_t = SesameBLETransport::decode_result_t;
-	DEBUG_PRINTLN("received %u", size);
-	auto drc = session->transport.decode(data, size, session->crypt);
-	if (drc != decode_result_t::received) {
-		return true;
+	bool rc = true;
+	for (size_t i = 0; i < count; i++) {
+		DEBUG_PRINTLN("received %zu", packets[i].size);
+		if (session->transport.decode(packets[i].data, packets[i].size, session->crypt) != decode_result_t::received) {
+			continue;
+		}
+		rc = handle_command(*session) && rc;
+		// session may be cleared while handling the command
+		if ((session = get_session(session_id)) == nullptr) {
+			return rc;
+		}
 	}
-	data = session->transport.data();
-	size = session->transport.data_size();
+	session->transport.release_buffer();
+	return rc;
+}
 
+bool
+SesameServerCoreImpl::handle_command(ServerSession& session) {
+	const auto* data = session.transport.data();
+	size_t size = session.transport.data_size();
 	if (size < 1) {
 		DEBUG_PRINTLN("Too short command ignored");
 		return true;
@@ -101,16 +127,16 @@ SesameServerCoreImpl::on_received(uint16_t session_id, const std::byte* data, si
 	bool rc;
 	switch (code) {
 		case item_code_t::registration:
-			rc = handle_registration(*session, data + 1, size - 1);
+			rc = handle_registration(session, data + 1, size - 1);
 			break;
 		case item_code_t::login:
-			rc = handle_login(*session, data + 1, size - 1);
+			rc = handle_login(session, data + 1, size - 1);
 			break;
 		case item_code_t::lock:
 		case item_code_t::unlock:
 		case item_code_t::door_open:
 		case item_code_t::door_closed:
-			rc = handle_cmd_with_tag(*session, code, data + 1, size - 1);
+			rc = handle_cmd_with_tag(session, code, data + 1, size - 1);
 			break;
 		default:
 			DEBUG_PRINTLN("Unhandled command %u %s", static_cast<uint8_t>(code), util::bin2hex(data + 1, size - 1).c_str());
@@ -144,6 +170,8 @@ SesameServerCoreImpl::on_disconnected(uint16_t session_id) {
 	for (auto& [id, session] : vsessions) {
 		if (id == session_id) {
 			DEBUG_PRINTLN("Session %u cleared", session_id);
+			closed_iv_resync_count += session->crypt.get_resync_count();
+			closed_transport_stats += session->transport.get_stats();
 			id.reset();
 			session.reset();
 			return;
@@ -152,6 +180,62 @@ SesameServerCoreImpl::on_disconnected(uint16_t session_id) {
 	DEBUG_PRINTLN("Session %u not found (on_disconnected)", session_id);
 }
 
+bool
+SesameServerCoreImpl::on_mtu_changed(uint16_t session_id, uint16_t mtu) {
+	auto* session = get_session(session_id);
+	if (session == nullptr) {
+		DEBUG_PRINTLN("Session %u not found (on_mtu_changed)", session_id);
+		return false;
+	}
+	session->transport.set_mtu(mtu);
+	DEBUG_PRINTLN("Session %u fragment size=%zu", session_id, session->transport.get_fragment_size());
+	return true;
+}
+
+bool
+SesameServerCoreImpl::on_tx_ready(uint16_t session_id) {
+	auto* session = get_session(session_id);
+	if (session == nullptr) {
+		DEBUG_PRINTLN("Session %u not found (on_tx_ready)", session_id);
+		return false;
+	}
+	return session->transport.flush();
+}
+
+size_t
+SesameServerCoreImpl::get_tx_queue_depth(uint16_t session_id) const {
+	for (const auto& [id, session] : vsessions) {
+		if (id == session_id) {
+			return session->transport.get_queue_depth();
+		}
+	}
+	return 0;
+}
+
+transport_stats_t
+SesameServerCoreImpl::get_transport_stats(std::optional<uint16_t> session_id) const {
+	transport_stats_t stats{};
+	if (!session_id) {
+		stats = closed_transport_stats;
+	}
+	for (const auto& [id, session] : vsessions) {
+		if (id && (!session_id || id == session_id)) {
+			stats += session->transport.get_stats();
+		}
+	}
+	return stats;
+}
+
+void
+SesameServerCoreImpl::reset_transport_stats() {
+	closed_transport_stats = {};
+	for (auto& [id, session] : vsessions) {
+		if (id) {
+			session->transport.reset_stats();
+		}
+	}
+}
+
 bool
 SesameServerCoreImpl::handle_registration(ServerSession& session, const std::byte* payload, size_t size) {
 	if (size != sizeof(Sesame::os3_cmd_registration_t)) {
@@ -326,7 +410,10 @@ SesameServerCoreImpl::create_session(uint16_t session_id) {
 		return nullptr;
 	}
 	fnd->first.emplace(session_id);
-	fnd->second.emplace(ble_backend, session_id);
+	const size_t slot = fnd - vsessions.begin();
+	fnd->second.emplace(ble_backend, session_id, recv_pool, tx_storage.data() + slot * tx_queue_size, tx_queue_size);
+	fnd->second->crypt.set_resync_window(iv_resync_window);
+	fnd->second->crypt.set_keystream_storage(keystreams ? &keystreams[slot] : nullptr);
 	DEBUG_PRINTLN("session %u created", session_id);
 	return &*fnd->second;
 }
@@ -369,10 +456,13 @@ void
 SesameServerCoreImpl::update() {
 	for (auto& [id, session] : vsessions) {
 		if (id.has_value()) {
+			session->transport.flush();
 			auto now = millis();
 			switch (session->state) {
 				case session_state_t::idle:
+					break;
 				case session_state_t::running:
+					session->crypt.precompute_keystream();
 					break;
 				case session_state_t::waiting_login:
 					if (auto elapsed = now - session->last_state_changed; elapsed > auth_timeout) {
@@ -413,6 +503,42 @@ SesameServerCoreImpl::send_notify(std::optional<uint16_t> session_id,
 	}
 }
 
+void
+SesameServerCoreImpl::set_iv_resync_window(uint8_t window) {
+	iv_resync_window = window;
+	for (auto& [id, session] : vsessions) {
+		if (id) {
+			session->crypt.set_resync_window(window);
+		}
+	}
+}
+
+void
+SesameServerCoreImpl::set_keystream_precompute(bool enable) {
+	if (enable && !keystreams) {
+		keystreams = std::make_unique<keystream_pair_t[]>(vsessions.size());
+	}
+	for (size_t slot = 0; slot < vsessions.size(); slot++) {
+		if (auto& [id, session] = vsessions[slot]; id) {
+			session->crypt.set_keystream_storage(enable ? &keystreams[slot] : nullptr);
+		}
+	}
+	if (!enable) {
+		keystreams.reset();
+	}
+}
+
+uint32_t
+SesameServerCoreImpl::get_iv_resync_count() const {
+	uint32_t count = closed_iv_resync_count;
+	for (const auto& [id, session] : vsessions) {
+		if (id) {
+			count += session->crypt.get_resync_count();
+		}
+	}
+	return count;
+}
+
 bool
 SesameServerCoreImpl::has_session(uint16_t session_id) const {
 	return std::find_if(vsessions.begin(), vsessions.end(), [session_id](auto& pair) { return pair.first == session_id; }) !=
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstddef>
+#include <memory>
 #include <optional>
 #include <tuple>
 #include <utility>
@@ -11,6 +12,10 @@
 #include "libsesame3bt/ServerCore.h"
 #include "transport.h"
 
+#ifndef LIBSESAME3BTCORE_SERVER_RECV_SIZE
+#define LIBSESAME3BTCORE_SERVER_RECV_SIZE 256
+#endif
+
 namespace libsesame3bt::core {
 
 enum class session_state_t { idle, waiting_login, running };
@@ -19,12 +24,20 @@ class SesameServerCoreImpl;
 
 class ServerSession : SesameBLEBackend {
  public:
-	ServerSession(ServerBLEBackend& backend, uint16_t session_id) : backend(backend), session_id(session_id), transport(*this) {}
+	static constexpr size_t MAX_RECV = LIBSESAME3BTCORE_SERVER_RECV_SIZE;
+	static_assert(MAX_RECV >= 1 + sizeof(Sesame::os3_cmd_registration_t), "LIBSESAME3BTCORE_SERVER_RECV_SIZE too small");
+
+	ServerSession(ServerBLEBackend& backend,
+	              uint16_t session_id,
+	              SesameBLEBufferPool& recv_pool,
+	              std::byte* tx_storage,
+	              size_t tx_queue_size)
+	    : backend(backend), session_id(session_id), transport(*this, recv_pool, tx_storage, tx_queue_size) {}
 	virtual ~ServerSession() = default;
 
  private:
 	friend class SesameServerCoreImpl;
-	CryptHandler crypt{std::in_place_type<OS3IVHandler>, true};
+	BasicCryptHandler<OS3IVHandler, crypt_role_t::peripheral> crypt;
 	std::byte nonce[4];
 	session_state_t state = session_state_t::idle;
 	uint32_t last_state_changed = 0;
@@ -32,13 +45,26 @@ class ServerSession : SesameBLEBackend {
 	const uint16_t session_id;
 	SesameBLETransport transport;
 	virtual bool write_to_tx(const uint8_t* data, size_t size) override { return backend.write_to_central(session_id, data, size); };
+	virtual size_t write_fragments_to_tx(const tx_fragment_t* fragments, size_t count) override {
+		return backend.write_fragments_to_central(session_id, fragments, count);
+	}
+	virtual uint8_t* lease_tx_buffer(size_t size) override { return backend.lease_central_buffer(session_id, size); }
+	virtual bool commit_tx_buffer(uint8_t* buffer, size_t size) override {
+		return backend.commit_central_buffer(session_id, buffer, size);
+	}
+	virtual void cancel_tx_buffer(uint8_t* buffer) override { backend.cancel_central_buffer(session_id, buffer); }
+	virtual bool get_time_ms(uint32_t& now) override { return backend.get_time_ms(now); }
 	virtual void disconnect() override { backend.disconnect(session_id); }
 	void set_state(session_state_t state);
 };
 
 class SesameServerCoreImpl {
  public:
-	SesameServerCoreImpl(ServerBLEBackend& backend, SesameServerCore& core, size_t max_sessions);
+	SesameServerCoreImpl(ServerBLEBackend& backend,
+	                     SesameServerCore& core,
+	                     size_t max_sessions,
+	                     size_t recv_buffers,
+	                     size_t tx_queue_size);
 	bool begin(libsesame3bt::Sesame::model_t model, const uint8_t (&uuid)[16]);
 	void update();
 	bool set_registered(const std::array<std::byte, Sesame::SECRET_SIZE>& secret);
@@ -52,7 +78,13 @@ class SesameServerCoreImpl {
 
 	bool on_subscribed(uint16_t session_id);
 	bool on_received(uint16_t session_id, const std::byte* data, size_t size);
+	bool on_received_batch(uint16_t session_id, const rx_packet_t* packets, size_t count);
 	void on_disconnected(uint16_t session_id);
+	bool on_mtu_changed(uint16_t session_id, uint16_t mtu);
+	bool on_tx_ready(uint16_t session_id);
+	size_t get_tx_queue_depth(uint16_t session_id) const;
+	transport_stats_t get_transport_stats(std::optional<uint16_t> session_id) const;
+	void reset_transport_stats();
 	bool has_session(uint16_t session_id) const;
 
 	void set_on_registration_callback(registration_callback_t callback) { on_registration_callback = callback; }
@@ -63,6 +95,9 @@ class SesameServerCoreImpl {
 	void set_mecha_setting(const Sesame::mecha_setting_5_t& setting) { mecha_setting = setting; }
 	void set_mecha_status(const Sesame::mecha_status_5_t& status) { mecha_status = status; }
 	void set_auto_send_flags(auto_send::flags flags) { auto_send_flags = flags; }
+	void set_iv_resync_window(uint8_t window);
+	uint32_t get_iv_resync_count() const;
+	void set_keystream_precompute(bool enable);
 
 	std::tuple<std::string, std::string> create_advertisement_data_os3() const;
 
@@ -79,13 +114,23 @@ class SesameServerCoreImpl {
 	Sesame::model_t model = Sesame::model_t::unknown;
 	uint8_t uuid[16];
 	std::array<std::byte, Sesame::SECRET_SIZE> secret;
+	SesameBLEBufferPool recv_pool;
+	// send queue storage of each session slot, reused across connections
+	const size_t tx_queue_size;
+	std::vector<std::byte> tx_storage;
+	// key streams of each session slot, allocated while precompute is enabled
+	std::unique_ptr<keystream_pair_t[]> keystreams;
 	std::vector<std::pair<std::optional<uint16_t>, std::optional<ServerSession>>> vsessions;
 	uint32_t auth_timeout = DEFAULT_AUTH_TIMEOUT_MSEC;
 	Sesame::mecha_setting_5_t mecha_setting{-100, 100, 0};
 	Sesame::mecha_status_5_t mecha_status{6 * 500, -32768, 0, false, true, false, false, true, false, false};
 	auto_send::flags auto_send_flags =
 	    static_cast<auto_send::flags>(auto_send::flags::mecha_setting | auto_send::flags::mecha_status);
+	uint8_t iv_resync_window = 0;
+	uint32_t closed_iv_resync_count = 0;  // sum of cleared sessions
+	transport_stats_t closed_transport_stats{};
 
+	bool handle_command(ServerSession& session);
 	bool handle_registration(ServerSession& session, const std::byte* payload, size_t size);
 	bool handle_login(ServerSession& session, const std::byte* payload, size_t size);
 	bool handle_cmd_with_tag(ServerSession& session, Sesame::item_code_t cmd, const std::byte* payload, size_t size);
@@ -1,110 +1,340 @@
 #include "crypt.h"
-#include <mbedtls/cmac.h>
 #include <cstddef>
 #include "debug.h"
-#include "libsesame3bt/util.h"
 
 namespace libsesame3bt::core {
 
-using util::to_byte;
-using util::to_cptr;
-using util::to_ptr;
-
+/*
+ * AES-CCM decryption is done with CTR and CBC-MAC of SesameCcm (not with mbedtls_ccm_*),
+ * so the CTR part can proceed as fragments arrive (decrypt_update()).
+ * CBC-MAC needs the total message length in the first block, it is left to decrypt_finish().
+ * Encryption works in place on fragment payloads (chunked_buffer_t), the same way.
+ */
+template <typename IVPolicy, crypt_role_t Role>
 bool
-CryptHandler::decrypt(const std::byte* in, size_t in_len, std::byte* out, size_t out_size) {
+BasicCryptHandler<IVPolicy, Role>::decrypt(const std::byte* in, size_t in_len, std::byte* out, size_t out_size) {
 	if (in_len < CMAC_TAG_SIZE || out_size < in_len - CMAC_TAG_SIZE) {
 		return false;
 	}
-	const auto& iv = as_peripheral ? c2p_iv : p2c_iv;
-	int mbrc;
-	if ((mbrc = mbedtls_ccm_auth_decrypt(&ccm_de_ctx, in_len - CMAC_TAG_SIZE, to_cptr(iv), iv.size(), to_cptr(auth_add_data),
-	                                     auth_add_data.size(), to_cptr(in), to_ptr(out), to_cptr(&in[in_len - CMAC_TAG_SIZE]),
-	                                     CMAC_TAG_SIZE)) != 0) {
-		DEBUG_PRINTF("%d: auth_decrypt failed\n", mbrc);
+	decrypt_begin();
+	if (!ctr_crypt(in, out, in_len - CMAC_TAG_SIZE)) {
 		return false;
 	}
-	update_dec_iv();
+	return authenticate(in, out, in_len - CMAC_TAG_SIZE, &in[in_len - CMAC_TAG_SIZE]);
+}
+
+// decrypt in place, plain text (size - CMAC_TAG_SIZE bytes) overwrites the head of data
+template <typename IVPolicy, crypt_role_t Role>
+bool
+BasicCryptHandler<IVPolicy, Role>::decrypt(std::byte* data, size_t size) {
+	decrypt_begin();
+	return decrypt_finish(data, size);
+}
+
+template <typename IVPolicy, crypt_role_t Role>
+void
+BasicCryptHandler<IVPolicy, Role>::decrypt_begin() {
+	de_stream_pos = 0;
+}
+
+/**
+ * @brief Decrypt partially received message in place
+ *
+ * @param data head of the message
+ * @param size bytes known to be cipher text (must not include any of CMAC tag)
+ * @return true
+ * @return false
+ */
+template <typename IVPolicy, crypt_role_t Role>
+bool
+BasicCryptHandler<IVPolicy, Role>::decrypt_update(std::byte* data, size_t size) {
+	if (size <= de_stream_pos) {
+		return true;
+	}
+	return ctr_crypt(&data[de_stream_pos], &data[de_stream_pos], size - de_stream_pos);
+}
+
+/**
+ * @brief Decrypt remaining part of the message in place and verify
+ *
+ * @param data whole message (including CMAC tag), head of it may be decrypted by decrypt_update()
+ * @param size size of data
+ * @return true
+ * @return false
+ */
+template <typename IVPolicy, crypt_role_t Role>
+bool
+BasicCryptHandler<IVPolicy, Role>::decrypt_finish(std::byte* data, size_t size) {
+	if (size < CMAC_TAG_SIZE || de_stream_pos > size - CMAC_TAG_SIZE) {
+		return false;
+	}
+	if (!decrypt_update(data, size - CMAC_TAG_SIZE)) {
+		return false;
+	}
+	return authenticate(data, data, size - CMAC_TAG_SIZE, &data[size - CMAC_TAG_SIZE]);
+}
+
+// restore cipher text decrypted by decrypt_update() (the message turned out to be plain)
+template <typename IVPolicy, crypt_role_t Role>
+void
+BasicCryptHandler<IVPolicy, Role>::decrypt_abort(std::byte* data) {
+	size_t decrypted = de_stream_pos;
+	de_stream_pos = 0;
+	ctr_crypt(data, data, decrypted);  // XOR with the same key stream again
+	de_stream_pos = 0;
+}
+
+/*
+ * Verify decrypted message (out), on success decrypt IV is advanced.
+ * On failure, retry with following IVs within the resync window (messages may have been lost).
+ * in: cipher text (same as out when decrypted in place)
+ */
+template <typename IVPolicy, crypt_role_t Role>
+bool
+BasicCryptHandler<IVPolicy, Role>::authenticate(const std::byte* in, std::byte* out, size_t size, const std::byte* tag) {
+	if (verify_tag(out, size, tag)) {
+		update_dec_iv();
+		return true;
+	}
+	if (resync_window > 0) {
+		auto saved_handler = iv_handler;
+		auto saved_iv = dec_iv();
+		for (size_t i = 0; i < resync_window; i++) {
+			if (in == out) {
+				// restore cipher text
+				de_stream_pos = 0;
+				ctr_crypt(out, out, size);
+			}
+			update_dec_iv();
+			de_stream_pos = 0;
+			if (ctr_crypt(in, out, size) && verify_tag(out, size, tag)) {
+				DEBUG_PRINTF("IV resynchronized (skipped %zu)\n", i + 1);
+				resync_count++;
+				update_dec_iv();
+				return true;
+			}
+		}
+		iv_handler = saved_handler;
+		dec_iv() = saved_iv;
+	}
+	DEBUG_PRINTLN("auth_decrypt failed");
+	zeroize(out, size);
+	return false;
+}
+
+template <typename IVPolicy, crypt_role_t Role>
+bool
+BasicCryptHandler<IVPolicy, Role>::ctr_crypt(const std::byte* in, std::byte* out, size_t size) {
+	const auto nonce = dec_nonce();
+	for (size_t i = 0; i < size; i++, de_stream_pos++) {
+		size_t offset = de_stream_pos % Aes128::BLOCK_SIZE;
+		if (offset == 0 && !nonce.stream(session_key, de_stream_pos / Aes128::BLOCK_SIZE + 1, de_stream_block)) {
+			return false;
+		}
+		out[i] = in[i] ^ de_stream_block[offset];
+	}
 	return true;
 }
 
+template <typename IVPolicy, crypt_role_t Role>
 bool
-CryptHandler::encrypt(const std::byte* in, size_t in_len, std::byte* out, size_t out_size) {
+BasicCryptHandler<IVPolicy, Role>::verify_tag(const std::byte* plain, size_t size, const std::byte* tag) {
+	SesameCcm::tag_t expected;
+	if (!SesameCcm::compute_tag(session_key, dec_nonce(), plain, size, expected)) {
+		return false;
+	}
+	std::byte diff{0};
+	for (size_t i = 0; i < CMAC_TAG_SIZE; i++) {
+		diff |= expected[i] ^ tag[i];
+	}
+	return diff == std::byte{0};
+}
+
+template <typename IVPolicy, crypt_role_t Role>
+bool
+BasicCryptHandler<IVPolicy, Role>::encrypt(const std::byte* in, size_t in_len, std::byte* out, size_t out_size) {
 	if (out_size < in_len + CMAC_TAG_SIZE) {
 		return false;
 	}
-	const auto& iv = as_peripheral ? p2c_iv : c2p_iv;
-	int rc;
-	if ((rc = mbedtls_ccm_encrypt_and_tag(&ccm_en_ctx, in_len, to_cptr(iv), iv.size(), to_cptr(auth_add_data), auth_add_data.size(),
-	                                      to_cptr(in), to_ptr(out), to_ptr(&out[in_len]), CMAC_TAG_SIZE)) != 0) {
-		DEBUG_PRINTF("%d: encrypt_and_tag failed\n", rc);
+	std::copy(in, in + in_len, out);
+	std::byte* chunks[]{out};
+	return encrypt(chunked_buffer_t{chunks, SIZE_MAX}, in_len);
+}
+
+/**
+ * @brief Encrypt in place and append CMAC tag
+ *
+ * @param data plain text (size bytes), followed by room for the tag
+ * @param size size of plain text
+ * @return true
+ * @return false
+ */
+template <typename IVPolicy, crypt_role_t Role>
+bool
+BasicCryptHandler<IVPolicy, Role>::encrypt(const chunked_buffer_t& data, size_t size) {
+	SesameCcm::tag_t tag;
+	if (!SesameCcm::encrypt(session_key, enc_nonce(), data, size, tag)) {
+		DEBUG_PRINTLN("encrypt failed");
+		return false;
 	}
+	data.write(size, tag.data(), tag.size());
 	update_enc_iv();
 	return true;
 }
 
+template <typename IVPolicy, crypt_role_t Role>
 bool
-CryptHandler::set_session_key(const std::byte* key,
-                              size_t key_size,
-                              const std::array<std::byte, Sesame::TOKEN_SIZE>& local_nonce,
-                              const std::byte (&remote_nonce)[Sesame::TOKEN_SIZE]) {
-	if (int mbrc = mbedtls_ccm_setkey(&ccm_en_ctx, mbedtls_cipher_id_t::MBEDTLS_CIPHER_ID_AES, to_cptr(key), key_size * 8);
-	    mbrc != 0) {
-		DEBUG_PRINTF("%d: ccm_setkey for encrypt failed\n", mbrc);
-		return false;
-	}
-	if (int mbrc = mbedtls_ccm_setkey(&ccm_de_ctx, mbedtls_cipher_id_t::MBEDTLS_CIPHER_ID_AES, to_cptr(key), key_size * 8);
-	    mbrc != 0) {
-		DEBUG_PRINTF("%d: ccm_setkey for decrypt failed\n", mbrc);
+BasicCryptHandler<IVPolicy, Role>::set_session_key(const std::byte* key,
+                                                   size_t key_size,
+                                                   const std::array<std::byte, Sesame::TOKEN_SIZE>& local_nonce,
+                                                   const std::byte (&remote_nonce)[Sesame::TOKEN_SIZE]) {
+	// key streams of the previous key would be taken for the new one if IVs match
+	clear_keystreams();
+	de_stream_pos = 0;
+	if (!session_key.set_key(key, key_size)) {
 		return false;
 	}
 	std::copy(key, key + auth_code.size(), std::begin(auth_code));
-	init_endec_iv(local_nonce, remote_nonce);
+	iv_handler.init_ivs(local_nonce, remote_nonce, c2p_iv, p2c_iv);
 	key_prepared = true;
 	return true;
 }
 
+template <typename IVPolicy, crypt_role_t Role>
 void
-CryptHandler::reset_session_key() {
-	ccm_en_ctx.reset();
-	ccm_de_ctx.reset();
+BasicCryptHandler<IVPolicy, Role>::reset_session_key() {
+	session_key.reset();
+	clear_keystreams();
+	de_stream_pos = 0;
 	key_prepared = false;
 }
 
+template <typename IVPolicy, crypt_role_t Role>
+void
+BasicCryptHandler<IVPolicy, Role>::set_keystream_storage(keystream_pair_t* storage) {
+	// storage may be handed to another session later, do not leave key streams of this session behind
+	clear_keystreams();
+	keystreams = storage;
+	clear_keystreams();
+}
+
+/*
+ * Compute key streams for the next messages (IVs are predictable) while idle,
+ * so that only CBC-MAC and XOR are left when a message is sent or received.
+ * Messages longer than Keystream::BLOCKS blocks compute the rest as usual.
+ */
+template <typename IVPolicy, crypt_role_t Role>
+bool
+BasicCryptHandler<IVPolicy, Role>::precompute_keystream() {
+	if (!keystreams || !key_prepared) {
+		return true;
+	}
+	auto& [en, de] = *keystreams;
+	if (!en.is_for(enc_iv()) && !en.prepare(session_key, enc_iv())) {
+		return false;
+	}
+	if (!de.is_for(dec_iv()) && !de.prepare(session_key, dec_iv())) {
+		return false;
+	}
+	return true;
+}
+
+template <typename IVPolicy, crypt_role_t Role>
 bool
-CryptHandler::verify_auth_code(const std::byte* code) const {
+BasicCryptHandler<IVPolicy, Role>::verify_auth_code(const std::byte* code) const {
 	return std::equal(std::cbegin(auth_code), std::cend(auth_code), code);
 }
 
+template class BasicCryptHandler<OS3IVHandler, crypt_role_t::central>;
+template class BasicCryptHandler<OS3IVHandler, crypt_role_t::peripheral>;
+template class BasicCryptHandler<OS2IVHandler, crypt_role_t::central>;
+template class BasicCryptHandler<OS2IVHandler, crypt_role_t::peripheral>;
+
+#if !defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+
+namespace {
+
+// multiply by x in GF(2^128) (RFC 4493 2.3)
+void
+cmac_double(Aes128::block_t& block) {
+	auto msb = std::to_integer<uint8_t>(block[0]) >> 7;
+	for (size_t i = 0; i < block.size() - 1; i++) {
+		block[i] = block[i] << 1 | block[i + 1] >> 7;
+	}
+	block.back() = block.back() << 1 ^ std::byte(msb * 0x87);
+}
+
+}  // namespace
+
 bool
 CmacAes128::set_key(const std::byte (&key)[16]) {
-	int mbrc;
-	if ((mbrc = mbedtls_cipher_setup(&ctx, mbedtls_cipher_info_from_type(mbedtls_cipher_type_t::MBEDTLS_CIPHER_AES_128_ECB))) != 0) {
-		DEBUG_PRINTF("%d: cipher setup failed\n", mbrc);
-		return false;
-	}
-	if ((mbrc = mbedtls_cipher_cmac_starts(&ctx, to_cptr(key), sizeof(key) * 8)) != 0) {
-		DEBUG_PRINTF("%d: cmac start failed\n", mbrc);
+	mac = {};
+	pending_size = 0;
+	if (!aes.set_key(key, sizeof(key))) {
+		DEBUG_PRINTLN("cmac set_key failed");
 		return false;
 	}
 	return true;
 }
 
+void
+CmacAes128::reset() {
+	aes.reset();
+	zeroize(mac.data(), mac.size());
+	zeroize(pending.data(), pending.size());
+	pending_size = 0;
+}
+
 bool
 CmacAes128::update(const std::byte* data, size_t size) {
-	if (int mbrc = mbedtls_cipher_cmac_update(&ctx, to_cptr(data), size); mbrc != 0) {
-		DEBUG_PRINTF("%d: cmac update failed\n", mbrc);
-		return false;
+	while (size > 0) {
+		if (pending_size == pending.size()) {
+			for (size_t i = 0; i < mac.size(); i++) {
+				mac[i] ^= pending[i];
+			}
+			if (!aes.encrypt(mac, mac)) {
+				DEBUG_PRINTLN("cmac update failed");
+				return false;
+			}
+			pending_size = 0;
+		}
+		size_t n = std::min(size, pending.size() - pending_size);
+		std::copy(data, data + n, &pending[pending_size]);
+		pending_size += n;
+		data += n;
+		size -= n;
 	}
 	return true;
 }
 
 bool
 CmacAes128::finish(std::byte (&cmac)[16]) {
-	if (int mbrc = mbedtls_cipher_cmac_finish(&ctx, to_ptr(cmac)); mbrc != 0) {
-		DEBUG_PRINTF("%d: cmac_finish failed\n", mbrc);
+	Aes128::block_t subkey{};
+	if (!aes.encrypt(subkey, subkey)) {
+		DEBUG_PRINTLN("cmac_finish failed");
 		return false;
 	}
-	return true;
+	cmac_double(subkey);  // K1: complete last block
+	if (pending_size < pending.size()) {
+		cmac_double(subkey);  // K2: padded last block
+		pending[pending_size] = std::byte{0x80};
+		std::fill(&pending[pending_size + 1], pending.data() + pending.size(), std::byte{0});
+	}
+	for (size_t i = 0; i < mac.size(); i++) {
+		mac[i] ^= pending[i] ^ subkey[i];
+	}
+	bool rc = aes.encrypt(mac, mac);
+	std::copy(std::cbegin(mac), std::cend(mac), cmac);
+	zeroize(subkey.data(), subkey.size());
+	zeroize(pending.data(), pending.size());
+	mac = {};
+	pending_size = 0;
+	if (!rc) {
+		DEBUG_PRINTLN("cmac_finish failed");
+	}
+	return rc;
 }
 
+#endif
+
 }  // namespace libsesame3bt::core
@@ -1,19 +1,25 @@
 #pragma once
-#include <mbedtls/ccm.h>
-#include <mbedtls/cipher.h>
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <variant>
 #include "Sesame.h"
 #include "api_wrapper.h"
+#include "crypt_aes.h"
+#include "crypt_ccm.h"
+#include "crypt_provider.h"
 #include "os2_iv.h"
 #include "os3_iv.h"
 
 namespace libsesame3bt::core {
 
+/// @brief AES-CMAC (RFC 4493), on Aes128 with Mbed TLS provider (no cipher context on heap)
 class CmacAes128 {
  public:
 	CmacAes128() {}
+	CmacAes128(const CmacAes128&) = delete;
+	CmacAes128& operator=(const CmacAes128&) = delete;
+	~CmacAes128() { reset(); }
 	bool set_key(const std::byte (&key)[16]);
 	bool set_key(const std::array<std::byte, 16>& key) { return set_key(*reinterpret_cast<const std::byte(*)[16]>(key.data())); }
 	bool update(const std::byte* data, size_t size);
@@ -27,33 +33,87 @@ class CmacAes128 {
 	}
 	bool finish(std::byte (&cmac)[16]);
 	bool finish(std::array<std::byte, 16>& cmac) { return finish(*reinterpret_cast<std::byte(*)[16]>(cmac.data())); }
+	/// @brief Wipe key and state (set_key() is required before next use)
+	void reset();
 
  private:
-	api_wrapper<mbedtls_cipher_context_t> ctx{mbedtls_cipher_init, mbedtls_cipher_free};
+#if defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+	psa_key_wrapper key;
+	psa_mac_operation_t operation = PSA_MAC_OPERATION_INIT;
+#else
+	Aes128 aes;
+	Aes128::block_t mac;
+	// last block is held back until finish() (it is masked with a subkey)
+	Aes128::block_t pending;
+	size_t pending_size = 0;
+#endif
 };
 
-class CryptHandler {
+/**
+ * @brief Message laid out in separate chunks of fixed size (fragment payloads)
+ */
+struct chunked_buffer_t {
+	std::byte* const* chunks;
+	size_t chunk_size;
+
+	std::byte& operator[](size_t pos) const { return chunks[pos / chunk_size][pos % chunk_size]; }
+	void write(size_t pos, const std::byte* src, size_t size) const {
+		while (size > 0) {
+			size_t n = std::min(size, chunk_size - pos % chunk_size);
+			std::copy(src, src + n, &(*this)[pos]);
+			pos += n;
+			src += n;
+			size -= n;
+		}
+	}
+};
+
+enum class crypt_role_t : uint8_t { central, peripheral };
+
+// key streams for the next encrypted / decrypted message
+using keystream_pair_t = std::array<SesameCcm::Keystream, 2>;
+
+/**
+ * @brief Session encryption with IV scheme (OS3IVHandler / OS2IVHandler) and role fixed at compile time
+ */
+template <typename IVPolicy, crypt_role_t Role>
+class BasicCryptHandler {
  public:
-	static constexpr size_t CMAC_TAG_SIZE = 4;
-	template <typename T>
-	CryptHandler(std::in_place_type_t<T> t, bool as_peripheral = false) : iv_handler(t), as_peripheral(as_peripheral) {}
+	static constexpr size_t CMAC_TAG_SIZE = SesameCcm::TAG_SIZE;
+	BasicCryptHandler() {}
+	~BasicCryptHandler() { set_keystream_storage(nullptr); }
+	BasicCryptHandler(const BasicCryptHandler&) = delete;
+	BasicCryptHandler& operator=(const BasicCryptHandler&) = delete;
 	void update_enc_iv() {
-		if (as_peripheral) {
-			std::visit([this](auto& v) { v.update_p2c_iv(p2c_iv); }, iv_handler);
+		if constexpr (Role == crypt_role_t::peripheral) {
+			iv_handler.update_p2c_iv(p2c_iv);
 		} else {
-			std::visit([this](auto& v) { v.update_c2p_iv(c2p_iv); }, iv_handler);
+			iv_handler.update_c2p_iv(c2p_iv);
 		}
 	}
 	void update_dec_iv() {
-		if (as_peripheral) {
-			std::visit([this](auto& v) { v.update_c2p_iv(c2p_iv); }, iv_handler);
+		if constexpr (Role == crypt_role_t::peripheral) {
+			iv_handler.update_c2p_iv(c2p_iv);
 		} else {
-			std::visit([this](auto& v) { v.update_p2c_iv(p2c_iv); }, iv_handler);
+			iv_handler.update_p2c_iv(p2c_iv);
 		}
 	}
 	bool is_key_shared() const { return key_prepared; }
 	bool decrypt(const std::byte* in, size_t in_size, std::byte* out, size_t out_size);
+	bool decrypt(std::byte* data, size_t size);
+	void decrypt_begin();
+	bool decrypt_update(std::byte* data, size_t size);
+	bool decrypt_finish(std::byte* data, size_t size);
+	void decrypt_abort(std::byte* data);
+	size_t get_decrypted_size() const { return de_stream_pos; }
+	/// @note Each extra IV tried raises the chance of accepting a forged message (32 bits tag).
+	void set_resync_window(uint8_t window) { resync_window = window; }
+	uint32_t get_resync_count() const { return resync_count; }
+	/// @param storage owned by the caller and used until replaced (nullptr disables precompute)
+	void set_keystream_storage(keystream_pair_t* storage);
+	bool precompute_keystream();
 	bool encrypt(const std::byte* in, size_t in_size, std::byte* out, size_t out_size);
+	bool encrypt(const chunked_buffer_t& data, size_t size);
 	bool set_session_key(const std::byte* key,
 	                     size_t key_size,
 	                     const std::array<std::byte, Sesame::TOKEN_SIZE>& local_nonce,
@@ -62,20 +122,123 @@ class CryptHandler {
 	bool verify_auth_code(const std::byte* code) const;
 
  private:
-	std::variant<OS3IVHandler, OS2IVHandler> iv_handler;
-	const bool as_peripheral;
-	api_wrapper<mbedtls_ccm_context> ccm_en_ctx{mbedtls_ccm_init, mbedtls_ccm_free};
-	api_wrapper<mbedtls_ccm_context> ccm_de_ctx{mbedtls_ccm_init, mbedtls_ccm_free};
-	static constexpr std::array<std::byte, 1> auth_add_data{};
+	IVPolicy iv_handler;
+	// One key schedule for both directions, each direction keeps its own counter state (IV, de_stream_*)
+	Aes128 session_key;
 	std::array<std::byte, 13> c2p_iv;
 	std::array<std::byte, 13> p2c_iv;
 	std::array<std::byte, 4> auth_code;
 	bool key_prepared = false;
+	size_t de_stream_pos = 0;
+	std::array<std::byte, 16> de_stream_block;
+	uint8_t resync_window = 0;
+	uint32_t resync_count = 0;
+	keystream_pair_t* keystreams = nullptr;
 
-	void init_endec_iv(const std::array<std::byte, Sesame::TOKEN_SIZE>& local_nonce,
-	                   const std::byte (&remote_nonce)[Sesame::TOKEN_SIZE]) {
-		std::visit([local_nonce, remote_nonce, this](auto& v) { v.init_ivs(local_nonce, remote_nonce, c2p_iv, p2c_iv); }, iv_handler);
+	std::array<std::byte, 13>& dec_iv() {
+		if constexpr (Role == crypt_role_t::peripheral) {
+			return c2p_iv;
+		} else {
+			return p2c_iv;
+		}
+	}
+	const std::array<std::byte, 13>& enc_iv() const {
+		if constexpr (Role == crypt_role_t::peripheral) {
+			return p2c_iv;
+		} else {
+			return c2p_iv;
+		}
+	}
+	SesameCcm::Nonce enc_nonce() const { return SesameCcm::Nonce{enc_iv(), keystreams ? &(*keystreams)[0] : nullptr}; }
+	SesameCcm::Nonce dec_nonce() { return SesameCcm::Nonce{dec_iv(), keystreams ? &(*keystreams)[1] : nullptr}; }
+	void clear_keystreams() {
+		if (keystreams) {
+			for (auto& ks : *keystreams) {
+				ks.clear();
+			}
+		}
+	}
+	bool ctr_crypt(const std::byte* in, std::byte* out, size_t size);
+	bool verify_tag(const std::byte* plain, size_t size, const std::byte* tag);
+	bool authenticate(const std::byte* in, std::byte* out, size_t size, const std::byte* tag);
+};
+
+extern template class BasicCryptHandler<OS3IVHandler, crypt_role_t::central>;
+extern template class BasicCryptHandler<OS3IVHandler, crypt_role_t::peripheral>;
+extern template class BasicCryptHandler<OS2IVHandler, crypt_role_t::central>;
+extern template class BasicCryptHandler<OS2IVHandler, crypt_role_t::peripheral>;
+
+/**
+ * @brief BasicCryptHandler with IV scheme and role chosen at runtime
+ * Use visit() to run a whole operation on the concrete handler (one dispatch per message).
+ */
+class CryptHandler {
+ public:
+	static constexpr size_t CMAC_TAG_SIZE = SesameCcm::TAG_SIZE;
+	template <typename T>
+	CryptHandler(std::in_place_type_t<T>, bool as_peripheral = false)
+	    : handler(as_peripheral ? handler_t{std::in_place_type<BasicCryptHandler<T, crypt_role_t::peripheral>>}
+	                            : handler_t{std::in_place_type<BasicCryptHandler<T, crypt_role_t::central>>}) {}
+	template <typename F>
+	decltype(auto) visit(F&& f) {
+		return std::visit(std::forward<F>(f), handler);
 	}
+	template <typename T, crypt_role_t Role>
+	BasicCryptHandler<T, Role>& get() {
+		return std::get<BasicCryptHandler<T, Role>>(handler);
+	}
+	void update_enc_iv() {
+		visit([](auto& h) { h.update_enc_iv(); });
+	}
+	void update_dec_iv() {
+		visit([](auto& h) { h.update_dec_iv(); });
+	}
+	bool is_key_shared() const {
+		return std::visit([](auto& h) { return h.is_key_shared(); }, handler);
+	}
+	bool decrypt(const std::byte* in, size_t in_size, std::byte* out, size_t out_size) {
+		return visit([&](auto& h) { return h.decrypt(in, in_size, out, out_size); });
+	}
+	bool decrypt(std::byte* data, size_t size) {
+		return visit([&](auto& h) { return h.decrypt(data, size); });
+	}
+	void set_resync_window(uint8_t window) {
+		visit([window](auto& h) { h.set_resync_window(window); });
+	}
+	uint32_t get_resync_count() const {
+		return std::visit([](auto& h) { return h.get_resync_count(); }, handler);
+	}
+	void set_keystream_storage(keystream_pair_t* storage) {
+		visit([storage](auto& h) { h.set_keystream_storage(storage); });
+	}
+	bool precompute_keystream() {
+		return visit([](auto& h) { return h.precompute_keystream(); });
+	}
+	bool encrypt(const std::byte* in, size_t in_size, std::byte* out, size_t out_size) {
+		return visit([&](auto& h) { return h.encrypt(in, in_size, out, out_size); });
+	}
+	bool encrypt(const chunked_buffer_t& data, size_t size) {
+		return visit([&](auto& h) { return h.encrypt(data, size); });
+	}
+	bool set_session_key(const std::byte* key,
+	                     size_t key_size,
+	                     const std::array<std::byte, Sesame::TOKEN_SIZE>& local_nonce,
+	                     const std::byte (&remote_nonce)[Sesame::TOKEN_SIZE]) {
+		return visit([&](auto& h) { return h.set_session_key(key, key_size, local_nonce, remote_nonce); });
+	}
+	void reset_session_key() {
+		visit([](auto& h) { h.reset_session_key(); });
+	}
+	bool verify_auth_code(const std::byte* code) const {
+		return std::visit([code](auto& h) { return h.verify_auth_code(code); }, handler);
+	}
+
+ private:
+	using handler_t = std::variant<BasicCryptHandler<OS3IVHandler, crypt_role_t::central>,
+	                               BasicCryptHandler<OS3IVHandler, crypt_role_t::peripheral>,
+	                               BasicCryptHandler<OS2IVHandler, crypt_role_t::central>,
+	                               BasicCryptHandler<OS2IVHandler, crypt_role_t::peripheral>>;
+	handler_t handler;
 };
 
 }  // namespace libsesame3bt::core
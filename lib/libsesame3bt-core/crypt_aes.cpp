@@ -0,0 +1,165 @@
+#include "crypt_aes.h"
+#include <cstring>
+#include "debug.h"
+#include "libsesame3bt/util.h"
+#if defined(LIBSESAME3BTCORE_AES_AESNI)
+#include <wmmintrin.h>
+#elif defined(LIBSESAME3BTCORE_AES_ARMV8)
+#include <arm_neon.h>
+#endif
+
+namespace libsesame3bt::core {
+
+using util::to_cptr;
+using util::to_ptr;
+
+#if defined(LIBSESAME3BTCORE_AES_AESNI) || defined(LIBSESAME3BTCORE_AES_ARMV8)
+
+void
+Aes128::reset() {
+	zeroize(round_keys.data(), round_keys.size());
+}
+
+#endif
+
+#if defined(LIBSESAME3BTCORE_AES_AESNI)
+
+namespace {
+
+// next round key from the previous one and AESKEYGENASSIST result (SubWord(RotWord(w3)) ^ rcon in the top word)
+__m128i
+expand_key(__m128i key, __m128i assist) {
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3)));
+}
+
+}  // namespace
+
+// rcon is an immediate operand of AESKEYGENASSIST, rounds are unrolled
+bool
+Aes128::set_key(const std::byte* key, size_t key_size) {
+	if (key_size != KEY_SIZE) {
+		DEBUG_PRINTF("%zu: Unsupported AES key size\n", key_size);
+		return false;
+	}
+	auto* rk = reinterpret_cast<__m128i*>(round_keys.data());
+	rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+	rk[1] = expand_key(rk[0], _mm_aeskeygenassist_si128(rk[0], 0x01));
+	rk[2] = expand_key(rk[1], _mm_aeskeygenassist_si128(rk[1], 0x02));
+	rk[3] = expand_key(rk[2], _mm_aeskeygenassist_si128(rk[2], 0x04));
+	rk[4] = expand_key(rk[3], _mm_aeskeygenassist_si128(rk[3], 0x08));
+	rk[5] = expand_key(rk[4], _mm_aeskeygenassist_si128(rk[4], 0x10));
+	rk[6] = expand_key(rk[5], _mm_aeskeygenassist_si128(rk[5], 0x20));
+	rk[7] = expand_key(rk[6], _mm_aeskeygenassist_si128(rk[6], 0x40));
+	rk[8] = expand_key(rk[7], _mm_aeskeygenassist_si128(rk[7], 0x80));
+	rk[9] = expand_key(rk[8], _mm_aeskeygenassist_si128(rk[8], 0x1b));
+	rk[10] = expand_key(rk[9], _mm_aeskeygenassist_si128(rk[9], 0x36));
+	return true;
+}
+
+bool
+Aes128::encrypt(const block_t& in, block_t& out) {
+	const auto* rk = reinterpret_cast<const __m128i*>(round_keys.data());
+	__m128i s = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in.data())), _mm_load_si128(&rk[0]));
+	for (size_t r = 1; r < ROUNDS; r++) {
+		s = _mm_aesenc_si128(s, _mm_load_si128(&rk[r]));
+	}
+	s = _mm_aesenclast_si128(s, _mm_load_si128(&rk[ROUNDS]));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out.data()), s);
+	return true;
+}
+
+const char*
+Aes128::backend_name() {
+	return "AES-NI";
+}
+
+#elif defined(LIBSESAME3BTCORE_AES_ARMV8)
+
+namespace {
+
+constexpr uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+
+// AESE with zero round key is ShiftRows(SubBytes()), ShiftRows does nothing when all columns are the same word
+uint32_t
+sub_word(uint32_t w) {
+	uint8x16_t s = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(w)), vdupq_n_u8(0));
+	return vgetq_lane_u32(vreinterpretq_u32_u8(s), 0);
+}
+
+}  // namespace
+
+// FIPS-197 key expansion, a word is loaded little endian (first byte in the low bits)
+bool
+Aes128::set_key(const std::byte* key, size_t key_size) {
+	if (key_size != KEY_SIZE) {
+		DEBUG_PRINTF("%zu: Unsupported AES key size\n", key_size);
+		return false;
+	}
+	std::copy(to_cptr(key), to_cptr(key) + KEY_SIZE, round_keys.begin());
+	for (size_t i = 4; i < 4 * (ROUNDS + 1); i++) {
+		uint32_t t, prev;
+		std::memcpy(&t, &round_keys[(i - 1) * 4], sizeof(t));
+		std::memcpy(&prev, &round_keys[(i - 4) * 4], sizeof(prev));
+		if (i % 4 == 0) {
+			t = sub_word(t);
+			t = (t >> 8 | t << 24) ^ rcon[i / 4 - 1];  // RotWord
+		}
+		t ^= prev;
+		std::memcpy(&round_keys[i * 4], &t, sizeof(t));
+	}
+	return true;
+}
+
+bool
+Aes128::encrypt(const block_t& in, block_t& out) {
+	uint8x16_t s = vld1q_u8(to_cptr(in.data()));
+	for (size_t r = 0; r < ROUNDS - 1; r++) {
+		s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(&round_keys[r * BLOCK_SIZE])));
+	}
+	s = vaeseq_u8(s, vld1q_u8(&round_keys[(ROUNDS - 1) * BLOCK_SIZE]));
+	s = veorq_u8(s, vld1q_u8(&round_keys[ROUNDS * BLOCK_SIZE]));
+	vst1q_u8(to_ptr(out.data()), s);
+	return true;
+}
+
+const char*
+Aes128::backend_name() {
+	return "ARMv8 Crypto Extensions";
+}
+
+#elif !defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+
+bool
+Aes128::set_key(const std::byte* key, size_t key_size) {
+	if (int mbrc = mbedtls_aes_setkey_enc(&ctx, to_cptr(key), key_size * 8); mbrc != 0) {
+		DEBUG_PRINTF("%d: aes_setkey failed\n", mbrc);
+		return false;
+	}
+	return true;
+}
+
+bool
+Aes128::encrypt(const block_t& in, block_t& out) {
+	if (int mbrc = mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, to_cptr(in), to_ptr(out)); mbrc != 0) {
+		DEBUG_PRINTF("%d: aes_crypt_ecb failed\n", mbrc);
+		return false;
+	}
+	return true;
+}
+
+void
+Aes128::reset() {
+	ctx.reset();
+}
+
+const char*
+Aes128::backend_name() {
+	return "Mbed TLS";
+}
+
+#endif
+
+}  // namespace libsesame3bt::core
@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "api_wrapper.h"
+#include "crypt_provider.h"
+
+/*
+ * AES block cipher implementation, selected at compile time:
+ * - PSA Crypto API (LIBSESAME3BTCORE_CRYPTO_PSA, see crypt_provider.h)
+ * - AES-NI (x86, compiled with -maes)
+ * - ARMv8 Cryptography Extensions (compiled with +crypto / +aes)
+ * - Mbed TLS otherwise (uses the AES peripheral on ESP32 when MBEDTLS_HARDWARE_AES is enabled in ESP-IDF)
+ * Define LIBSESAME3BTCORE_AES_MBEDTLS to always use Mbed TLS.
+ * Key expansion also uses the AES instructions. There is no runtime CPU detection, build for the target CPU
+ * (e.g. -maes or -march=native) to use the instructions. PCLMUL / PMULL are not used, they help GHASH (GCM) but not CCM.
+ */
+#if !defined(LIBSESAME3BTCORE_AES_MBEDTLS) && !defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+#if defined(__AES__) && defined(__SSE2__)
+#define LIBSESAME3BTCORE_AES_AESNI 1
+#elif defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO)
+#define LIBSESAME3BTCORE_AES_ARMV8 1
+#endif
+#endif
+#if !defined(LIBSESAME3BTCORE_AES_AESNI) && !defined(LIBSESAME3BTCORE_AES_ARMV8) && !defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+#include <mbedtls/aes.h>
+#endif
+
+namespace libsesame3bt::core {
+
+class Aes128 {
+ public:
+	static constexpr size_t BLOCK_SIZE = 16;
+	static constexpr size_t KEY_SIZE = 16;
+	using block_t = std::array<std::byte, BLOCK_SIZE>;
+
+	Aes128() {}
+	~Aes128() { reset(); }
+	Aes128(const Aes128&) = delete;
+	Aes128& operator=(const Aes128&) = delete;
+	bool set_key(const std::byte* key, size_t key_size);
+	/// @note in and out may be the same block
+	bool encrypt(const block_t& in, block_t& out);
+	void reset();
+	static const char* backend_name();
+
+ private:
+#if defined(LIBSESAME3BTCORE_AES_AESNI) || defined(LIBSESAME3BTCORE_AES_ARMV8)
+	static constexpr size_t ROUNDS = 10;
+	alignas(16) std::array<uint8_t, BLOCK_SIZE * (ROUNDS + 1)> round_keys;
+#elif defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+	psa_key_wrapper key;
+	// set up once per key, each block is one update (no key setup per block)
+	psa_cipher_operation_t operation = PSA_CIPHER_OPERATION_INIT;
+#else
+	api_wrapper<mbedtls_aes_context> ctx{mbedtls_aes_init, mbedtls_aes_free};
+#endif
+};
+
+}  // namespace libsesame3bt::core
@@ -0,0 +1,178 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "crypt_aes.h"
+#include "crypt_provider.h"
+
+#ifndef LIBSESAME3BTCORE_KEYSTREAM_BLOCKS
+#define LIBSESAME3BTCORE_KEYSTREAM_BLOCKS 4
+#endif
+
+namespace libsesame3bt::core {
+
+/*
+ * AES-CCM (RFC 3610) with the parameters fixed by SESAME:
+ * 13 bytes nonce (L=2), 1 byte zero additional data, 4 bytes tag (M=4).
+ * Block formatting is constant except for nonce, length and counter, so B_0 / A_i are built by copying
+ * a prepared block and B_1 (additional data) is a constant.
+ */
+class SesameCcm {
+ public:
+	static constexpr size_t NONCE_SIZE = 13;
+	static constexpr size_t TAG_SIZE = 4;
+	static constexpr size_t MAX_SIZE = 0xffff;
+	using block_t = Aes128::block_t;
+	using nonce_t = std::array<std::byte, NONCE_SIZE>;
+	using tag_t = std::array<std::byte, TAG_SIZE>;
+
+	/// @brief Key stream blocks S_0 .. S_BLOCKS computed in advance for a nonce
+	class Keystream {
+	 public:
+		static constexpr size_t BLOCKS = LIBSESAME3BTCORE_KEYSTREAM_BLOCKS;
+		~Keystream() { clear(); }
+		bool prepare(Aes128& aes, const nonce_t& nonce);
+		bool is_for(const nonce_t& nonce) const { return valid && nonce == this->nonce; }
+		const block_t& get(size_t i) const { return blocks[i]; }
+		void clear() {
+			zeroize(blocks.data(), sizeof(blocks));
+			valid = false;
+		}
+
+	 private:
+		nonce_t nonce;
+		std::array<block_t, BLOCKS + 1> blocks;
+		bool valid = false;
+	};
+
+	/// @brief Nonce formatted as A_0 (B_0 and A_i differ only in flags, length and counter)
+	class Nonce {
+	 public:
+		/// @param keystream used when precomputed for this nonce (may be nullptr)
+		explicit Nonce(const nonce_t& nonce, const Keystream* keystream = nullptr)
+		    : a0{std::byte{A_FLAGS}}, keystream(keystream && keystream->is_for(nonce) ? keystream : nullptr) {
+			for (size_t i = 0; i < NONCE_SIZE; i++) {
+				a0[1 + i] = nonce[i];
+			}
+		}
+		/// A_i, i starts from 1 for payload
+		block_t counter(size_t i) const {
+			block_t a = a0;
+			a[14] = std::byte(i >> 8);
+			a[15] = std::byte(i);
+			return a;
+		}
+		/// B_0 for size bytes payload
+		block_t b0(size_t size) const {
+			block_t b = counter(size);
+			b[0] = std::byte{B0_FLAGS};
+			return b;
+		}
+		/// S_i = E(A_i), from the precomputed key stream if available
+		bool stream(Aes128& aes, size_t i, block_t& out) const {
+			if (keystream && i <= Keystream::BLOCKS) {
+				out = keystream->get(i);
+				return true;
+			}
+			return aes.encrypt(counter(i), out);
+		}
+
+	 private:
+		block_t a0;
+		const Keystream* keystream;
+	};
+
+	/**
+	 * @brief CBC-MAC of the plain text encrypted with S_0
+	 *
+	 * @param plain anything indexable by position (pointer, chunked_buffer_t)
+	 */
+	template <typename T>
+	static bool compute_tag(Aes128& aes, const Nonce& nonce, const T& plain, size_t size, tag_t& tag) {
+		block_t mac;
+		if (!start_mac(aes, nonce, size, mac)) {
+			return false;
+		}
+		for (size_t pos = 0; pos < size; pos += BLOCK_SIZE) {
+			for (size_t i = 0; i < BLOCK_SIZE && pos + i < size; i++) {
+				mac[i] ^= plain[pos + i];
+			}
+			if (!aes.encrypt(mac, mac)) {
+				return false;
+			}
+		}
+		return finish_mac(aes, nonce, mac, tag);
+	}
+
+	/**
+	 * @brief Encrypt in place and compute tag (CBC-MAC and CTR in one pass)
+	 *
+	 * @param data anything indexable by position, plain text on input
+	 */
+	template <typename T>
+	static bool encrypt(Aes128& aes, const Nonce& nonce, const T& data, size_t size, tag_t& tag) {
+		block_t mac;
+		if (!start_mac(aes, nonce, size, mac)) {
+			return false;
+		}
+		block_t stream;
+		for (size_t pos = 0; pos < size; pos += BLOCK_SIZE) {
+			if (!nonce.stream(aes, pos / BLOCK_SIZE + 1, stream)) {
+				return false;
+			}
+			for (size_t i = 0; i < BLOCK_SIZE && pos + i < size; i++) {
+				auto& b = data[pos + i];
+				mac[i] ^= b;
+				b ^= stream[i];
+			}
+			if (!aes.encrypt(mac, mac)) {
+				return false;
+			}
+		}
+		return finish_mac(aes, nonce, mac, tag);
+	}
+
+ private:
+	static constexpr size_t BLOCK_SIZE = Aes128::BLOCK_SIZE;
+	static constexpr uint8_t L = 2;
+	static constexpr uint8_t A_FLAGS = L - 1;
+	static constexpr uint8_t B0_FLAGS = 0x40 | ((TAG_SIZE - 2) / 2) << 3 | A_FLAGS;
+	// B_1 = length of additional data (1) | additional data (0x00) | padding
+	static constexpr block_t AAD_BLOCK{std::byte{0x00}, std::byte{0x01}};
+
+	static bool start_mac(Aes128& aes, const Nonce& nonce, size_t size, block_t& mac) {
+		if (size > MAX_SIZE || !aes.encrypt(nonce.b0(size), mac)) {
+			return false;
+		}
+		for (size_t i = 0; i < BLOCK_SIZE; i++) {
+			mac[i] ^= AAD_BLOCK[i];
+		}
+		return aes.encrypt(mac, mac);
+	}
+	static bool finish_mac(Aes128& aes, const Nonce& nonce, const block_t& mac, tag_t& tag) {
+		block_t s0;
+		if (!nonce.stream(aes, 0, s0)) {
+			return false;
+		}
+		for (size_t i = 0; i < TAG_SIZE; i++) {
+			tag[i] = mac[i] ^ s0[i];
+		}
+		return true;
+	}
+};
+
+inline bool
+SesameCcm::Keystream::prepare(Aes128& aes, const nonce_t& nonce) {
+	valid = false;
+	Nonce n{nonce};
+	for (size_t i = 0; i <= BLOCKS; i++) {
+		if (!aes.encrypt(n.counter(i), blocks[i])) {
+			return false;
+		}
+	}
+	this->nonce = nonce;
+	valid = true;
+	return true;
+}
+
+}  // namespace libsesame3bt::core
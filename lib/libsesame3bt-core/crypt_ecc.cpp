@@ -1,9 +1,11 @@
 #include "crypt_ecc.h"
-#include <mbedtls/ecdh.h>
 #include "Sesame.h"
 #include "crypt_random.h"
 #include "debug.h"
 #include "libsesame3bt/util.h"
+#if !defined(LIBSESAME3BTCORE_CRYPTO_PSA) && !defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+#include <mbedtls/ecdh.h>
+#include <mbedtls/platform_util.h>
 
 namespace libsesame3bt::core {
 
@@ -15,7 +17,7 @@ bool Ecc::static_initialized = [] {
 		DEBUG_PRINTLN("ecp_group_load failed");
 		return false;
 	}
-	return Random::static_initialized;
+	return true;
 }();
 
 bool
@@ -51,41 +53,31 @@ Ecc::export_pk(std::array<std::byte, PK_SIZE>& binary) {
 }
 
 bool
-Ecc::derive_secret(const std::array<std::byte, PK_SIZE>& remote_pk_bin, std::array<std::byte, Sesame::SECRET_SIZE>& sesame_secret) {
+Ecc::ecdh(const std::array<std::byte, PK_SIZE>& remote_pk_bin, std::array<std::byte, SK_SIZE>& shared_secret) {
+	if (!have_keypair) {
+		DEBUG_PRINTLN("Keypair not generated");
+		return false;
+	}
 	api_wrapper<mbedtls_ecp_point> remote_pk{mbedtls_ecp_point_init, mbedtls_ecp_point_free};
 	if (!convert_binary_to_pk(remote_pk_bin, remote_pk)) {
 		return false;
 	}
 	api_wrapper<mbedtls_mpi> secret{mbedtls_mpi_init, mbedtls_mpi_free};
-	if (!ecdh(remote_pk, secret)) {
-		return false;
-	}
-	std::array<std::byte, SK_SIZE> secret_bin;
-	if (!convert_sk_to_binary(secret, secret_bin)) {
+	if (int mbrc = mbedtls_ecdh_compute_shared(&ec_grp, &secret, &remote_pk, &sk, mbedtls_ctr_drbg_random, &Random::rng_ctx); mbrc != 0) {
+		DEBUG_PRINTF("%d: ecdh_compute_shared failed\n", mbrc);
 		return false;
 	}
-	std::copy(std::cbegin(secret_bin), std::cbegin(secret_bin) + sizeof(sesame_secret), std::begin(sesame_secret));
-
-	return true;
-}
-
-bool
-Ecc::ecdh(const api_wrapper<mbedtls_ecp_point>& remote_pk, api_wrapper<mbedtls_mpi>& shared_secret) {
-	if (int mbrc = mbedtls_ecdh_compute_shared(&ec_grp, &shared_secret, &remote_pk, &sk, mbedtls_ctr_drbg_random, &Random::rng_ctx);
-	    mbrc != 0) {
-		DEBUG_PRINTF("%d: ecdh_compute_shared failed\n", mbrc);
+	if (int mbrc = mbedtls_mpi_write_binary(&secret, to_ptr(shared_secret), shared_secret.size()); mbrc != 0) {
+		DEBUG_PRINTF("%d: mpi_write_binary failed\n", mbrc);
 		return false;
 	}
 	return true;
 }
 
 bool
-Ecc::convert_sk_to_binary(const api_wrapper<mbedtls_mpi>& sk, std::array<std::byte, SK_SIZE>& binary) {
-	if (int mbrc = mbedtls_mpi_write_binary(&sk, to_ptr(binary), binary.size()); mbrc != 0) {
-		DEBUG_PRINTF("%d: mpi_write_binary failed\n", mbrc);
-		return false;
-	}
-	return true;
+Ecc::check_pk(const std::array<std::byte, PK_SIZE>& binary) {
+	api_wrapper<mbedtls_ecp_point> pk{mbedtls_ecp_point_init, mbedtls_ecp_point_free};
+	return convert_binary_to_pk(binary, pk);
 }
 
 bool
@@ -123,4 +115,88 @@ Ecc::load_key(const std::array<std::byte, 32>& privkey) {
 	return true;
 }
 
+#if defined(LIBSESAME3BTCORE_ECP_RESTARTABLE)
+
+/*
+ * mbedtls_ecp_mul_restartable() returns MBEDTLS_ERR_ECP_IN_PROGRESS when the budget set by mbedtls_ecp_set_max_ops()
+ * is used up, and continues from the state in rs_ctx on the next call with the same arguments.
+ * The budget is global in Mbed TLS: it is set just before each step and reset to unlimited (0) in finish_step(),
+ * so other mbedtls_ecp_* callers are not left with a budget between steps.
+ */
+Ecc::step_result_t
+Ecc::generate_keypair_step() {
+	if (!rs_started) {
+		have_keypair = false;
+		if (int mbrc = mbedtls_ecp_gen_privkey(&ec_grp, &sk, mbedtls_ctr_drbg_random, &Random::rng_ctx); mbrc != 0) {
+			DEBUG_PRINTF("%d: ecp_gen_privkey failed\n", mbrc);
+			return step_result_t::failed;
+		}
+		rs_started = true;
+	}
+	mbedtls_ecp_set_max_ops(LIBSESAME3BTCORE_ECP_MAX_OPS);
+	auto rc = finish_step(
+	    mbedtls_ecp_mul_restartable(&ec_grp, &pk, &sk, &ec_grp->G, mbedtls_ctr_drbg_random, &Random::rng_ctx, &rs_ctx));
+	if (rc == step_result_t::done) {
+		have_keypair = true;
+	}
+	return rc;
+}
+
+Ecc::step_result_t
+Ecc::ecdh_step(const std::array<std::byte, PK_SIZE>& remote_pk, std::array<std::byte, SK_SIZE>& shared_secret) {
+	if (!rs_started) {
+		if (!have_keypair) {
+			DEBUG_PRINTLN("Keypair not generated");
+			return step_result_t::failed;
+		}
+		if (!convert_binary_to_pk(remote_pk, rs_peer)) {
+			return step_result_t::failed;
+		}
+		rs_started = true;
+	}
+	mbedtls_ecp_set_max_ops(LIBSESAME3BTCORE_ECP_MAX_OPS);
+	auto rc = finish_step(
+	    mbedtls_ecp_mul_restartable(&ec_grp, &rs_shared, &sk, &rs_peer, mbedtls_ctr_drbg_random, &Random::rng_ctx, &rs_ctx));
+	if (rc != step_result_t::done) {
+		return rc;
+	}
+	// shared secret is X coordinate (point at infinity is rejected by the length check)
+	std::array<std::byte, 1 + PK_SIZE> temp;
+	size_t olen;
+	if (int mbrc = mbedtls_ecp_point_write_binary(&ec_grp, &rs_shared, MBEDTLS_ECP_PF_UNCOMPRESSED, &olen, to_ptr(temp.data()),
+	                                              temp.size());
+	    mbrc != 0 || olen != temp.size()) {
+		DEBUG_PRINTF("%d: ecdh shared point invalid\n", mbrc);
+		return step_result_t::failed;
+	}
+	std::copy(&temp[1], &temp[1 + SK_SIZE], shared_secret.begin());
+	mbedtls_platform_zeroize(temp.data(), temp.size());
+	return step_result_t::done;
+}
+
+void
+Ecc::abort_step() {
+	mbedtls_ecp_restart_free(&rs_ctx);
+	mbedtls_ecp_restart_init(&rs_ctx);
+	rs_started = false;
+}
+
+Ecc::step_result_t
+Ecc::finish_step(int mbrc) {
+	mbedtls_ecp_set_max_ops(0);
+	if (mbrc == MBEDTLS_ERR_ECP_IN_PROGRESS) {
+		return step_result_t::in_progress;
+	}
+	rs_started = false;
+	if (mbrc != 0) {
+		DEBUG_PRINTF("%d: ecp_mul_restartable failed\n", mbrc);
+		return step_result_t::failed;
+	}
+	return step_result_t::done;
+}
+
+#endif
+
 }  // namespace libsesame3bt::core
+
+#endif
@@ -1,36 +1,109 @@
 #pragma once
-#include <mbedtls/ecp.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include "Sesame.h"
+#include "crypt_provider.h"
 #include "crypt_random.h"
+#if !defined(LIBSESAME3BTCORE_CRYPTO_PSA) && !defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+#include <mbedtls/ecp.h>
+#if defined(MBEDTLS_ECP_RESTARTABLE)
+#define LIBSESAME3BTCORE_ECP_RESTARTABLE 1
+#endif
+#endif
+
+#ifndef LIBSESAME3BTCORE_ECP_MAX_OPS
+#define LIBSESAME3BTCORE_ECP_MAX_OPS 1000
+#endif
 
 namespace libsesame3bt::core {
-class SesameServerCoreImpl;
-class Ecc {
-	friend class SesameServerCoreImpl;
 
+/// @brief P-256 key pair and ECDH (public key is X | Y, 64 bytes)
+class Ecc {
  public:
 	static constexpr size_t PK_SIZE = 64;
 	static constexpr size_t SK_SIZE = 32;
 	Ecc() {}
+#if defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+	~Ecc();
+	using limbs_t = std::array<uint32_t, 8>;
+#endif
 	Ecc(const Ecc&) = delete;
 	Ecc& operator=(const Ecc&) = delete;
 
 	bool generate_keypair();
-	bool load_key(const std::array<std::byte, 32>& privkey);
+	bool load_key(const std::array<std::byte, SK_SIZE>& privkey);
 	bool export_pk(std::array<std::byte, PK_SIZE>& binary);
-	bool ecdh(const api_wrapper<mbedtls_ecp_point>& remote_pk, api_wrapper<mbedtls_mpi>& shared_secret);
-	bool derive_secret(const std::array<std::byte, PK_SIZE>& remote_pk, std::array<std::byte, Sesame::SECRET_SIZE>& shared_secret);
-	bool convert_sk_to_binary(const api_wrapper<mbedtls_mpi>& sk, std::array<std::byte, SK_SIZE>& binary);
-	bool convert_binary_to_pk(const std::array<std::byte, PK_SIZE>& binary, api_wrapper<mbedtls_ecp_point>& pk);
+	bool ecdh(const std::array<std::byte, PK_SIZE>& remote_pk, std::array<std::byte, SK_SIZE>& shared_secret);
+	/// @brief Shared secret truncated to Sesame::SECRET_SIZE
+	bool derive_secret(const std::array<std::byte, PK_SIZE>& remote_pk, std::array<std::byte, Sesame::SECRET_SIZE>& shared_secret) {
+		std::array<std::byte, SK_SIZE> secret;
+		if (!ecdh(remote_pk, secret)) {
+			return false;
+		}
+		std::copy(std::cbegin(secret), std::cbegin(secret) + shared_secret.size(), std::begin(shared_secret));
+		return true;
+	}
+	static bool check_pk(const std::array<std::byte, PK_SIZE>& binary);
+
+	enum class step_result_t : uint8_t { done, in_progress, failed };
+	/**
+	 * @brief Restartable generate_keypair() / ecdh(), call with the same arguments while in_progress
+	 * @note With MBEDTLS_ECP_RESTARTABLE each call does at most LIBSESAME3BTCORE_ECP_MAX_OPS basic operations,
+	 * otherwise each call does the whole operation.
+	 * @warning The Mbed TLS operation budget is global. While a step runs, ECP operations on another task
+	 * may return MBEDTLS_ERR_ECP_IN_PROGRESS, so do not use this next to other ECP users on another task.
+	 */
+	step_result_t generate_keypair_step();
+	step_result_t ecdh_step(const std::array<std::byte, PK_SIZE>& remote_pk, std::array<std::byte, SK_SIZE>& shared_secret);
+	/// @brief Discard the operation in progress
+	void abort_step();
 
-	static bool initialized() { return static_initialized; }
+	// Random is initialized in another translation unit, its flag is read at call time
+	static bool initialized() { return static_initialized && Random::static_initialized; }
 
  private:
 	static bool static_initialized;
+#if defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+	limbs_t sk{};
+	std::array<std::byte, PK_SIZE> pk{};
+	bool have_keypair = false;
+
+	bool derive_pk();
+#elif defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+	psa_key_wrapper key;
+#else
 	static inline api_wrapper<mbedtls_ecp_group> ec_grp{mbedtls_ecp_group_init, mbedtls_ecp_group_free};
 	bool have_keypair = false;
 	api_wrapper<mbedtls_ecp_point> pk{mbedtls_ecp_point_init, mbedtls_ecp_point_free};
 	api_wrapper<mbedtls_mpi> sk{mbedtls_mpi_init, mbedtls_mpi_free};
+
+	static bool convert_binary_to_pk(const std::array<std::byte, PK_SIZE>& binary, api_wrapper<mbedtls_ecp_point>& pk);
+#endif
+#if defined(LIBSESAME3BTCORE_ECP_RESTARTABLE)
+	api_wrapper<mbedtls_ecp_restart_ctx> rs_ctx{mbedtls_ecp_restart_init, mbedtls_ecp_restart_free};
+	api_wrapper<mbedtls_ecp_point> rs_peer{mbedtls_ecp_point_init, mbedtls_ecp_point_free};
+	api_wrapper<mbedtls_ecp_point> rs_shared{mbedtls_ecp_point_init, mbedtls_ecp_point_free};
+	bool rs_started = false;
+
+	step_result_t finish_step(int mbrc);
+#endif
 };
 
+#if !defined(LIBSESAME3BTCORE_ECP_RESTARTABLE)
+inline Ecc::step_result_t
+Ecc::generate_keypair_step() {
+	return generate_keypair() ? step_result_t::done : step_result_t::failed;
+}
+
+inline Ecc::step_result_t
+Ecc::ecdh_step(const std::array<std::byte, PK_SIZE>& remote_pk, std::array<std::byte, SK_SIZE>& shared_secret) {
+	return ecdh(remote_pk, shared_secret) ? step_result_t::done : step_result_t::failed;
+}
+
+inline void
+Ecc::abort_step() {}
+#endif
+
 }  // namespace libsesame3bt::core
@@ -0,0 +1,437 @@
+// Built-in P-256 implementation of Ecc (LIBSESAME3BTCORE_ECC_BUILTIN)
+#include "crypt_ecc.h"
+#if defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+#include "debug.h"
+
+/*
+ * Fixed size field elements (8 x 32 bit limbs, least significant first) in Montgomery form, no heap.
+ * Points use projective coordinates and the complete formulas for a = -3 (Renes, Costello, Batina 2016),
+ * scalar multiplication is a Montgomery ladder. Branches and memory accesses do not depend on secret values.
+ */
+
+namespace libsesame3bt::core {
+
+namespace {
+
+using fe_t = Ecc::limbs_t;
+
+struct point_t {
+	fe_t x;
+	fe_t y;
+	fe_t z;
+};
+
+constexpr size_t LIMBS = std::tuple_size_v<fe_t>;
+
+// clang-format off
+constexpr fe_t P = {0xffffffff, 0xffffffff, 0xffffffff, 0x00000000, 0x00000000, 0x00000000, 0x00000001, 0xffffffff};
+constexpr fe_t P_MINUS_2 = {0xfffffffd, 0xffffffff, 0xffffffff, 0x00000000, 0x00000000, 0x00000000, 0x00000001, 0xffffffff};
+constexpr fe_t N = {0xfc632551, 0xf3b9cac2, 0xa7179e84, 0xbce6faad, 0xffffffff, 0xffffffff, 0x00000000, 0xffffffff};
+// 2^512 mod p, converts to Montgomery form
+constexpr fe_t R2 = {0x00000003, 0x00000000, 0xffffffff, 0xfffffffb, 0xfffffffe, 0xffffffff, 0xfffffffd, 0x00000004};
+constexpr fe_t ONE = {1};
+// Montgomery form (x * 2^256 mod p) of 1, b and G
+constexpr fe_t ONE_M = {0x00000001, 0x00000000, 0x00000000, 0xffffffff, 0xffffffff, 0xffffffff, 0xfffffffe, 0x00000000};
+constexpr fe_t B_M = {0x29c4bddf, 0xd89cdf62, 0x78843090, 0xacf005cd, 0xf7212ed6, 0xe5a220ab, 0x04874834, 0xdc30061d};
+constexpr fe_t GX_M = {0x18a9143c, 0x79e730d4, 0x5fedb601, 0x75ba95fc, 0x77622510, 0x79fb732b, 0xa53755c6, 0x18905f76};
+constexpr fe_t GY_M = {0xce95560a, 0xddf25357, 0xba19e45c, 0x8b4ab8e4, 0xdd21f325, 0xd2e88688, 0x25885d85, 0x8571ff18};
+// clang-format on
+
+// r = a + b, returns carry
+uint32_t
+add_raw(fe_t& r, const fe_t& a, const fe_t& b) {
+	uint64_t c = 0;
+	for (size_t i = 0; i < LIMBS; i++) {
+		c += uint64_t{a[i]} + b[i];
+		r[i] = static_cast<uint32_t>(c);
+		c >>= 32;
+	}
+	return static_cast<uint32_t>(c);
+}
+
+// r = a - b, returns borrow
+uint32_t
+sub_raw(fe_t& r, const fe_t& a, const fe_t& b) {
+	uint64_t d = 0;
+	for (size_t i = 0; i < LIMBS; i++) {
+		d = uint64_t{a[i]} - b[i] - (d >> 63);
+		r[i] = static_cast<uint32_t>(d);
+	}
+	return static_cast<uint32_t>(d >> 63);
+}
+
+// r = mask ? a : b (mask is all 0 or all 1)
+void
+select(fe_t& r, const fe_t& a, const fe_t& b, uint32_t mask) {
+	for (size_t i = 0; i < LIMBS; i++) {
+		r[i] = (a[i] & mask) | (b[i] & ~mask);
+	}
+}
+
+bool
+is_zero(const fe_t& a) {
+	uint32_t acc = 0;
+	for (auto v : a) {
+		acc |= v;
+	}
+	return acc == 0;
+}
+
+bool
+is_less(const fe_t& a, const fe_t& b) {
+	fe_t t;
+	return sub_raw(t, a, b) != 0;
+}
+
+void
+fe_add(fe_t& r, const fe_t& a, const fe_t& b) {
+	fe_t s, t;
+	uint32_t carry = add_raw(s, a, b);
+	uint32_t borrow = sub_raw(t, s, P);
+	select(r, t, s, 0 - (carry | (borrow ^ 1)));
+}
+
+void
+fe_sub(fe_t& r, const fe_t& a, const fe_t& b) {
+	fe_t d, t;
+	uint32_t borrow = sub_raw(d, a, b);
+	add_raw(t, d, P);
+	select(r, t, d, 0 - borrow);
+}
+
+// Montgomery multiplication r = a * b / 2^256 mod p (CIOS, -p^-1 mod 2^32 is 1)
+void
+fe_mul(fe_t& r, const fe_t& a, const fe_t& b) {
+	uint32_t t[LIMBS + 2] = {};
+	for (size_t i = 0; i < LIMBS; i++) {
+		uint64_t c = 0;
+		for (size_t j = 0; j < LIMBS; j++) {
+			c += t[j];
+			c += uint64_t{a[j]} * b[i];
+			t[j] = static_cast<uint32_t>(c);
+			c >>= 32;
+		}
+		c += t[LIMBS];
+		t[LIMBS] = static_cast<uint32_t>(c);
+		t[LIMBS + 1] = static_cast<uint32_t>(c >> 32);
+
+		uint32_t m = t[0];
+		c = (uint64_t{t[0]} + uint64_t{m} * P[0]) >> 32;
+		for (size_t j = 1; j < LIMBS; j++) {
+			c += t[j];
+			c += uint64_t{m} * P[j];
+			t[j - 1] = static_cast<uint32_t>(c);
+			c >>= 32;
+		}
+		c += t[LIMBS];
+		t[LIMBS - 1] = static_cast<uint32_t>(c);
+		t[LIMBS] = t[LIMBS + 1] + static_cast<uint32_t>(c >> 32);
+	}
+	// t < 2p
+	fe_t lo, s;
+	std::copy(t, t + LIMBS, lo.begin());
+	uint32_t borrow = sub_raw(s, lo, P);
+	select(r, s, lo, 0 - (t[LIMBS] | (borrow ^ 1)));
+}
+
+// r = a^(p-2) = a^-1 (exponent is public)
+void
+fe_inv(fe_t& r, const fe_t& a) {
+	fe_t x = a;
+	for (int i = 254; i >= 0; i--) {
+		fe_mul(x, x, x);
+		if ((P_MINUS_2[i / 32] >> (i % 32)) & 1) {
+			fe_mul(x, x, a);
+		}
+	}
+	r = x;
+}
+
+void
+fe_from_bytes(fe_t& r, const std::byte* be) {
+	for (size_t i = 0; i < LIMBS; i++) {
+		const std::byte* p = be + (LIMBS - 1 - i) * 4;
+		r[i] = std::to_integer<uint32_t>(p[0]) << 24 | std::to_integer<uint32_t>(p[1]) << 16 |
+		       std::to_integer<uint32_t>(p[2]) << 8 | std::to_integer<uint32_t>(p[3]);
+	}
+}
+
+void
+fe_to_bytes(std::byte* be, const fe_t& a) {
+	for (size_t i = 0; i < LIMBS; i++) {
+		std::byte* p = be + (LIMBS - 1 - i) * 4;
+		p[0] = std::byte(a[i] >> 24);
+		p[1] = std::byte(a[i] >> 16);
+		p[2] = std::byte(a[i] >> 8);
+		p[3] = std::byte(a[i]);
+	}
+}
+
+// complete addition, a = -3 (RCB16 Algorithm 4), r may alias p or q
+void
+point_add(point_t& r, const point_t& p, const point_t& q) {
+	fe_t t0, t1, t2, t3, t4, x3, y3, z3;
+	fe_mul(t0, p.x, q.x);
+	fe_mul(t1, p.y, q.y);
+	fe_mul(t2, p.z, q.z);
+	fe_add(t3, p.x, p.y);
+	fe_add(t4, q.x, q.y);
+	fe_mul(t3, t3, t4);
+	fe_add(t4, t0, t1);
+	fe_sub(t3, t3, t4);
+	fe_add(t4, p.y, p.z);
+	fe_add(x3, q.y, q.z);
+	fe_mul(t4, t4, x3);
+	fe_add(x3, t1, t2);
+	fe_sub(t4, t4, x3);
+	fe_add(x3, p.x, p.z);
+	fe_add(y3, q.x, q.z);
+	fe_mul(x3, x3, y3);
+	fe_add(y3, t0, t2);
+	fe_sub(y3, x3, y3);
+	fe_mul(z3, B_M, t2);
+	fe_sub(x3, y3, z3);
+	fe_add(z3, x3, x3);
+	fe_add(x3, x3, z3);
+	fe_sub(z3, t1, x3);
+	fe_add(x3, t1, x3);
+	fe_mul(y3, B_M, y3);
+	fe_add(t1, t2, t2);
+	fe_add(t2, t1, t2);
+	fe_sub(y3, y3, t2);
+	fe_sub(y3, y3, t0);
+	fe_add(t1, y3, y3);
+	fe_add(y3, t1, y3);
+	fe_add(t1, t0, t0);
+	fe_add(t0, t1, t0);
+	fe_sub(t0, t0, t2);
+	fe_mul(t1, t4, y3);
+	fe_mul(t2, t0, y3);
+	fe_mul(y3, x3, z3);
+	fe_add(y3, y3, t2);
+	fe_mul(x3, x3, t3);
+	fe_sub(x3, x3, t1);
+	fe_mul(z3, z3, t4);
+	fe_mul(t1, t3, t0);
+	fe_add(z3, z3, t1);
+	r = {x3, y3, z3};
+}
+
+// doubling, a = -3 (RCB16 Algorithm 6), r may alias p
+void
+point_dbl(point_t& r, const point_t& p) {
+	fe_t t0, t1, t2, t3, x3, y3, z3;
+	fe_mul(t0, p.x, p.x);
+	fe_mul(t1, p.y, p.y);
+	fe_mul(t2, p.z, p.z);
+	fe_mul(t3, p.x, p.y);
+	fe_add(t3, t3, t3);
+	fe_mul(z3, p.x, p.z);
+	fe_add(z3, z3, z3);
+	fe_mul(y3, B_M, t2);
+	fe_sub(y3, y3, z3);
+	fe_add(x3, y3, y3);
+	fe_add(y3, x3, y3);
+	fe_sub(x3, t1, y3);
+	fe_add(y3, t1, y3);
+	fe_mul(y3, x3, y3);
+	fe_mul(x3, x3, t3);
+	fe_add(t3, t2, t2);
+	fe_add(t2, t2, t3);
+	fe_mul(z3, B_M, z3);
+	fe_sub(z3, z3, t2);
+	fe_sub(z3, z3, t0);
+	fe_add(t3, z3, z3);
+	fe_add(z3, z3, t3);
+	fe_add(t3, t0, t0);
+	fe_add(t0, t3, t0);
+	fe_sub(t0, t0, t2);
+	fe_mul(t0, t0, z3);
+	fe_add(y3, y3, t0);
+	fe_mul(t0, p.y, p.z);
+	fe_add(t0, t0, t0);
+	fe_mul(z3, t0, z3);
+	fe_sub(x3, x3, z3);
+	fe_mul(z3, t0, t1);
+	fe_add(z3, z3, z3);
+	fe_add(z3, z3, z3);
+	r = {x3, y3, z3};
+}
+
+void
+fe_swap(fe_t& a, fe_t& b, uint32_t mask) {
+	for (size_t i = 0; i < LIMBS; i++) {
+		uint32_t t = (a[i] ^ b[i]) & mask;
+		a[i] ^= t;
+		b[i] ^= t;
+	}
+}
+
+void
+point_swap(point_t& a, point_t& b, uint32_t bit) {
+	uint32_t mask = 0 - bit;
+	fe_swap(a.x, b.x, mask);
+	fe_swap(a.y, b.y, mask);
+	fe_swap(a.z, b.z, mask);
+}
+
+// Montgomery ladder over all 256 bits of k
+void
+point_mul(point_t& r, const fe_t& k, const point_t& p) {
+	point_t r0{{}, ONE_M, {}};  // point at infinity
+	point_t r1 = p;
+	uint32_t swap = 0;
+	for (int i = 255; i >= 0; i--) {
+		uint32_t bit = (k[i / 32] >> (i % 32)) & 1;
+		point_swap(r0, r1, swap ^ bit);
+		swap = bit;
+		point_add(r1, r0, r1);
+		point_dbl(r0, r0);
+	}
+	point_swap(r0, r1, swap);
+	r = r0;
+}
+
+// affine X | Y (big endian), fails on the point at infinity
+bool
+point_to_bytes(std::byte* x_bin, std::byte* y_bin, const point_t& p) {
+	if (is_zero(p.z)) {
+		return false;
+	}
+	fe_t zinv, v;
+	fe_inv(zinv, p.z);
+	fe_mul(v, p.x, zinv);
+	fe_mul(v, v, ONE);
+	fe_to_bytes(x_bin, v);
+	if (y_bin) {
+		fe_mul(v, p.y, zinv);
+		fe_mul(v, v, ONE);
+		fe_to_bytes(y_bin, v);
+	}
+	return true;
+}
+
+// X | Y on the curve y^2 = x^3 - 3x + b
+bool
+point_from_bytes(point_t& p, const std::array<std::byte, Ecc::PK_SIZE>& binary) {
+	fe_t x, y;
+	fe_from_bytes(x, binary.data());
+	fe_from_bytes(y, binary.data() + Ecc::PK_SIZE / 2);
+	if (!is_less(x, P) || !is_less(y, P)) {
+		return false;
+	}
+	fe_mul(p.x, x, R2);
+	fe_mul(p.y, y, R2);
+	p.z = ONE_M;
+	fe_t lhs, rhs, t;
+	fe_mul(lhs, p.y, p.y);
+	fe_mul(rhs, p.x, p.x);
+	fe_mul(rhs, rhs, p.x);
+	fe_add(t, p.x, p.x);
+	fe_add(t, t, p.x);
+	fe_sub(rhs, rhs, t);
+	fe_add(rhs, rhs, B_M);
+	return lhs == rhs;
+}
+
+// 0 < k < n
+bool
+is_valid_scalar(const fe_t& k) {
+	return !is_zero(k) && is_less(k, N);
+}
+
+}  // namespace
+
+bool Ecc::static_initialized = true;
+
+Ecc::~Ecc() {
+	zeroize(sk.data(), sizeof(sk));
+}
+
+bool
+Ecc::generate_keypair() {
+	have_keypair = false;
+	std::array<std::byte, SK_SIZE> bin;
+	// candidates not below n are discarded (probability 2^-32)
+	for (int count = 0;; count++) {
+		if (count >= 30) {
+			DEBUG_PRINTLN("Failed to generate private key");
+			return false;
+		}
+		if (!Random::get_random(bin)) {
+			return false;
+		}
+		fe_from_bytes(sk, bin.data());
+		if (is_valid_scalar(sk)) {
+			break;
+		}
+	}
+	zeroize(bin.data(), bin.size());
+	return derive_pk();
+}
+
+bool
+Ecc::load_key(const std::array<std::byte, SK_SIZE>& privkey) {
+	have_keypair = false;
+	fe_from_bytes(sk, privkey.data());
+	if (!is_valid_scalar(sk)) {
+		DEBUG_PRINTLN("Invalid secret key");
+		return false;
+	}
+	return derive_pk();
+}
+
+bool
+Ecc::derive_pk() {
+	point_t q;
+	point_mul(q, sk, {GX_M, GY_M, ONE_M});
+	if (!point_to_bytes(pk.data(), pk.data() + PK_SIZE / 2, q)) {
+		DEBUG_PRINTLN("Failed to derive public key");
+		return false;
+	}
+	have_keypair = true;
+	return true;
+}
+
+bool
+Ecc::export_pk(std::array<std::byte, PK_SIZE>& binary) {
+	if (!have_keypair) {
+		DEBUG_PRINTLN("Keypair not generated");
+		return false;
+	}
+	binary = pk;
+	return true;
+}
+
+bool
+Ecc::ecdh(const std::array<std::byte, PK_SIZE>& remote_pk, std::array<std::byte, SK_SIZE>& shared_secret) {
+	if (!have_keypair) {
+		DEBUG_PRINTLN("Keypair not generated");
+		return false;
+	}
+	point_t q;
+	if (!point_from_bytes(q, remote_pk)) {
+		DEBUG_PRINTLN("Invalid public key");
+		return false;
+	}
+	point_mul(q, sk, q);
+	if (!point_to_bytes(shared_secret.data(), nullptr, q)) {
+		DEBUG_PRINTLN("ECDH result is infinity");
+		return false;
+	}
+	return true;
+}
+
+bool
+Ecc::check_pk(const std::array<std::byte, PK_SIZE>& binary) {
+	point_t q;
+	if (!point_from_bytes(q, binary)) {
+		DEBUG_PRINTLN("Invalid public key");
+		return false;
+	}
+	return true;
+}
+
+}  // namespace libsesame3bt::core
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+/*
+ * Crypto provider, selected at compile time:
+ * - Mbed TLS (default), 2.x and 3.x
+ * - PSA Crypto API (define LIBSESAME3BTCORE_CRYPTO_PSA), goes through PSA drivers (secure elements, accelerators)
+ * A provider implements Aes128 (block cipher for AES-CCM, see SesameCcm), CmacAes128, Ecc (P-256 ECDH) and Random (DRBG).
+ * Ecc is replaced by the built-in implementation (crypt_p256.cpp) when LIBSESAME3BTCORE_ECC_BUILTIN is defined.
+ * zeroize() wipes secrets with the provider's function, other code does not include provider headers for it.
+ */
+#include <cstddef>
+#if defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+#include <psa/crypto.h>
+#else
+#include <mbedtls/platform_util.h>
+#endif
+
+namespace libsesame3bt::core {
+
+#if defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+
+// PSA Crypto API has no zeroize function, volatile stores are not removed by the optimizer
+inline void
+zeroize(void* buf, size_t size) {
+	volatile auto* p = static_cast<volatile std::byte*>(buf);
+	while (size--) {
+		*p++ = std::byte{0};
+	}
+}
+
+/// @brief PSA key identifier destroyed with the owner
+class psa_key_wrapper {
+ public:
+	psa_key_wrapper() {}
+	psa_key_wrapper(const psa_key_wrapper&) = delete;
+	psa_key_wrapper& operator=(const psa_key_wrapper&) = delete;
+	~psa_key_wrapper() { reset(); }
+	psa_key_id_t* operator&() { return &id; }
+	psa_key_id_t operator()() const { return id; }
+	explicit operator bool() const { return id != PSA_KEY_ID_NULL; }
+	void reset() {
+		if (id != PSA_KEY_ID_NULL) {
+			psa_destroy_key(id);
+			id = PSA_KEY_ID_NULL;
+		}
+	}
+
+ private:
+	psa_key_id_t id = PSA_KEY_ID_NULL;
+};
+
+#else
+
+inline void
+zeroize(void* buf, size_t size) {
+	mbedtls_platform_zeroize(buf, size);
+}
+
+#endif
+
+}  // namespace libsesame3bt::core
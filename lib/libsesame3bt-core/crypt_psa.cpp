@@ -0,0 +1,223 @@
+// Crypto provider on PSA Crypto API (LIBSESAME3BTCORE_CRYPTO_PSA)
+#if defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+#include "crypt.h"
+#include "crypt_aes.h"
+#include "crypt_ecc.h"
+#include "crypt_random.h"
+#include "debug.h"
+#include "libsesame3bt/util.h"
+
+namespace libsesame3bt::core {
+
+using util::to_cptr;
+using util::to_ptr;
+
+namespace {
+
+#if !defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+constexpr psa_key_type_t ECC_KEY_PAIR = PSA_KEY_TYPE_ECC_KEY_PAIR(PSA_ECC_FAMILY_SECP_R1);
+constexpr psa_key_type_t ECC_PUBLIC_KEY = PSA_KEY_TYPE_ECC_PUBLIC_KEY(PSA_ECC_FAMILY_SECP_R1);
+constexpr size_t ECC_BITS = 256;
+#endif
+
+psa_key_attributes_t
+key_attributes(psa_key_type_t type, size_t bits, psa_key_usage_t usage, psa_algorithm_t alg) {
+	psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+	psa_set_key_type(&attr, type);
+	psa_set_key_bits(&attr, bits);
+	psa_set_key_usage_flags(&attr, usage);
+	psa_set_key_algorithm(&attr, alg);
+	return attr;
+}
+
+#if !defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+// uncompressed point (SEC1 2.3.3) from X | Y
+std::array<std::byte, 1 + Ecc::PK_SIZE>
+to_sec1(const std::array<std::byte, Ecc::PK_SIZE>& binary) {
+	std::array<std::byte, 1 + Ecc::PK_SIZE> sec1;
+	sec1[0] = std::byte{4};
+	std::copy(std::cbegin(binary), std::cend(binary), &sec1[1]);
+	return sec1;
+}
+#endif
+
+}  // namespace
+
+// psa_crypto_init() before any other PSA call (other static initializers of this provider are in this file)
+bool Random::static_initialized = [] {
+	if (psa_status_t rc = psa_crypto_init(); rc != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: psa_crypto_init failed\n", rc);
+		return false;
+	}
+	return true;
+}();
+
+bool
+Random::get_random(std::byte* out, size_t size) {
+	if (psa_status_t rc = psa_generate_random(to_ptr(out), size); rc != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: generate_random failed\n", rc);
+		return false;
+	}
+	return true;
+}
+
+bool
+Aes128::set_key(const std::byte* key_data, size_t key_size) {
+	reset();
+	auto attr = key_attributes(PSA_KEY_TYPE_AES, key_size * 8, PSA_KEY_USAGE_ENCRYPT, PSA_ALG_ECB_NO_PADDING);
+	psa_status_t rc;
+	if ((rc = psa_import_key(&attr, to_cptr(key_data), key_size, &key)) != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: AES import_key failed\n", rc);
+		return false;
+	}
+	if ((rc = psa_cipher_encrypt_setup(&operation, key(), PSA_ALG_ECB_NO_PADDING)) != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: cipher_encrypt_setup failed\n", rc);
+		reset();
+		return false;
+	}
+	return true;
+}
+
+/*
+ * ECB without padding outputs each complete block on update, so the operation is never finished
+ * and serves all blocks encrypted with this key.
+ */
+bool
+Aes128::encrypt(const block_t& in, block_t& out) {
+	size_t olen;
+	if (psa_status_t rc = psa_cipher_update(&operation, to_cptr(in), in.size(), to_ptr(out), out.size(), &olen);
+	    rc != PSA_SUCCESS || olen != out.size()) {
+		DEBUG_PRINTF("%d: cipher_update failed\n", rc);
+		return false;
+	}
+	return true;
+}
+
+void
+Aes128::reset() {
+	psa_cipher_abort(&operation);
+	key.reset();
+}
+
+const char*
+Aes128::backend_name() {
+	return "PSA";
+}
+
+void
+CmacAes128::reset() {
+	psa_mac_abort(&operation);
+	key.reset();
+}
+
+bool
+CmacAes128::set_key(const std::byte (&key_data)[16]) {
+	psa_mac_abort(&operation);
+	key.reset();
+	auto attr = key_attributes(PSA_KEY_TYPE_AES, sizeof(key_data) * 8, PSA_KEY_USAGE_SIGN_MESSAGE, PSA_ALG_CMAC);
+	psa_status_t rc;
+	if ((rc = psa_import_key(&attr, to_cptr(key_data), sizeof(key_data), &key)) != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: CMAC import_key failed\n", rc);
+		return false;
+	}
+	if ((rc = psa_mac_sign_setup(&operation, key(), PSA_ALG_CMAC)) != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: mac_sign_setup failed\n", rc);
+		return false;
+	}
+	return true;
+}
+
+bool
+CmacAes128::update(const std::byte* data, size_t size) {
+	if (psa_status_t rc = psa_mac_update(&operation, to_cptr(data), size); rc != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: mac_update failed\n", rc);
+		return false;
+	}
+	return true;
+}
+
+bool
+CmacAes128::finish(std::byte (&cmac)[16]) {
+	size_t olen;
+	if (psa_status_t rc = psa_mac_sign_finish(&operation, to_ptr(cmac), sizeof(cmac), &olen); rc != PSA_SUCCESS || olen != sizeof(cmac)) {
+		DEBUG_PRINTF("%d: mac_sign_finish failed\n", rc);
+		return false;
+	}
+	return true;
+}
+
+#if !defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+bool Ecc::static_initialized = true;
+
+bool
+Ecc::generate_keypair() {
+	key.reset();
+	auto attr = key_attributes(ECC_KEY_PAIR, ECC_BITS, PSA_KEY_USAGE_DERIVE, PSA_ALG_ECDH);
+	if (psa_status_t rc = psa_generate_key(&attr, &key); rc != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: generate_key failed\n", rc);
+		return false;
+	}
+	return true;
+}
+
+bool
+Ecc::load_key(const std::array<std::byte, SK_SIZE>& privkey) {
+	key.reset();
+	auto attr = key_attributes(ECC_KEY_PAIR, ECC_BITS, PSA_KEY_USAGE_DERIVE, PSA_ALG_ECDH);
+	if (psa_status_t rc = psa_import_key(&attr, to_cptr(privkey), privkey.size(), &key); rc != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: Invalid secret key\n", rc);
+		return false;
+	}
+	return true;
+}
+
+bool
+Ecc::export_pk(std::array<std::byte, PK_SIZE>& binary) {
+	if (!key) {
+		DEBUG_PRINTLN("Keypair not generated");
+		return false;
+	}
+	std::array<std::byte, 1 + PK_SIZE> sec1;
+	size_t olen;
+	if (psa_status_t rc = psa_export_public_key(key(), to_ptr(sec1), sec1.size(), &olen); rc != PSA_SUCCESS || olen != sec1.size()) {
+		DEBUG_PRINTF("%d: export_public_key failed\n", rc);
+		return false;
+	}
+	std::copy(sec1.cbegin() + 1, sec1.cend(), binary.begin());
+	return true;
+}
+
+bool
+Ecc::ecdh(const std::array<std::byte, PK_SIZE>& remote_pk, std::array<std::byte, SK_SIZE>& shared_secret) {
+	if (!key) {
+		DEBUG_PRINTLN("Keypair not generated");
+		return false;
+	}
+	auto peer = to_sec1(remote_pk);
+	size_t olen;
+	if (psa_status_t rc = psa_raw_key_agreement(PSA_ALG_ECDH, key(), to_cptr(peer), peer.size(), to_ptr(shared_secret),
+	                                            shared_secret.size(), &olen);
+	    rc != PSA_SUCCESS || olen != shared_secret.size()) {
+		DEBUG_PRINTF("%d: raw_key_agreement failed\n", rc);
+		return false;
+	}
+	return true;
+}
+
+// importing a public key validates the point
+bool
+Ecc::check_pk(const std::array<std::byte, PK_SIZE>& binary) {
+	auto sec1 = to_sec1(binary);
+	auto attr = key_attributes(ECC_PUBLIC_KEY, ECC_BITS, 0, 0);
+	psa_key_wrapper pk;
+	if (psa_status_t rc = psa_import_key(&attr, to_cptr(sec1), sec1.size(), &pk); rc != PSA_SUCCESS) {
+		DEBUG_PRINTF("%d: Invalid public key\n", rc);
+		return false;
+	}
+	return true;
+}
+#endif
+
+}  // namespace libsesame3bt::core
+
+#endif
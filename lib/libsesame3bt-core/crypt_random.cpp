@@ -1,6 +1,7 @@
 #include "crypt_random.h"
 #include "debug.h"
 #include "libsesame3bt/util.h"
+#if !defined(LIBSESAME3BTCORE_CRYPTO_PSA)
 
 namespace libsesame3bt::core {
 
@@ -25,3 +26,5 @@ Random::get_random(std::byte* out, size_t size) {
 }
 
 }  // namespace libsesame3bt::core
+
+#endif
@@ -1,9 +1,12 @@
 #pragma once
-#include <mbedtls/ctr_drbg.h>
-#include <mbedtls/entropy.h>
 #include <array>
 #include <cstddef>
 #include "api_wrapper.h"
+#include "crypt_provider.h"
+#if !defined(LIBSESAME3BTCORE_CRYPTO_PSA)
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#endif
 
 namespace libsesame3bt::core {
 
@@ -19,14 +22,16 @@ class Random {
 		return get_random(out, N);
 	};
 	template <size_t N>
-	static bool get_random(std::array<std::byte, N> out) {
+	static bool get_random(std::array<std::byte, N>& out) {
 		return get_random(out.data(), out.size());
 	}
 
  private:
 	static bool static_initialized;
+#if !defined(LIBSESAME3BTCORE_CRYPTO_PSA)
 	static inline api_wrapper<mbedtls_ctr_drbg_context> rng_ctx{mbedtls_ctr_drbg_init, mbedtls_ctr_drbg_free};
 	static inline api_wrapper<mbedtls_entropy_context> ent_ctx{mbedtls_entropy_init, mbedtls_entropy_free};
+#endif
 };
 
 }  // namespace libsesame3bt::core
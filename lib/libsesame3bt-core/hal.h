@@ -5,7 +5,7 @@
 
 namespace libsesame3bt {
 
-uint32_t
+inline uint32_t
 millis() {
 #if defined(ESP32) || defined(ESP_PLATFORM)
 	return static_cast<uint32_t>(esp_timer_get_time() / 1000ULL);
@@ -14,4 +14,13 @@ millis() {
 #endif
 }
 
+inline uint32_t
+micros() {
+#if defined(ESP32) || defined(ESP_PLATFORM)
+	return static_cast<uint32_t>(esp_timer_get_time());
+#else
+#error "micros not defined on this environment."
+#endif
+}
+
 }  // namespace libsesame3bt
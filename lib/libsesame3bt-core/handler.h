@@ -4,6 +4,7 @@
 #include <string_view>
 #include <variant>
 #include "Sesame.h"
+#include "message.h"
 #include "os2.h"
 #include "os3.h"
 
@@ -11,12 +12,18 @@ namespace libsesame3bt::core {
 
 class Handler {
  public:
-	template <typename T>
-	Handler(std::in_place_type_t<T> t, SesameClientCoreImpl* client, SesameBLETransport& transport, CryptHandler& crypt)
+	template <typename T, typename Crypt>
+	Handler(std::in_place_type_t<T> t, SesameClientCoreImpl* client, SesameBLETransport& transport, Crypt& crypt)
 	    : handler(t, client, transport, crypt) {}
 	bool init() {
 		return std::visit([](auto& v) { return v.init(); }, handler);
 	}
+	void update() {
+		std::visit([](auto& v) { v.update(); }, handler);
+	}
+	void reset() {
+		std::visit([](auto& v) { v.reset(); }, handler);
+	}
 	bool set_keys(std::string_view pk_str, std::string_view secret_str) {
 		return std::visit([pk_str, secret_str](auto& v) { return v.set_keys(pk_str, secret_str); }, handler);
 	}
@@ -37,23 +44,23 @@ class Handler {
 		return std::visit([](auto& v) { return v.get_max_history_tag_size(); }, handler);
 	}
 
-	void handle_publish_initial(const std::byte* in, size_t in_len) {
-		std::visit([in, in_len](auto& v) { v.handle_publish_initial(in, in_len); }, handler);
+	void handle_publish_initial(MessageView msg) {
+		std::visit([msg](auto& v) { v.handle_publish_initial(msg); }, handler);
 	}
-	void handle_response_login(const std::byte* in, size_t in_len) {
-		std::visit([in, in_len](auto& v) { v.handle_response_login(in, in_len); }, handler);
+	void handle_response_login(MessageView msg) {
+		std::visit([msg](auto& v) { v.handle_response_login(msg); }, handler);
 	}
-	void handle_publish_mecha_setting(const std::byte* in, size_t in_len) {
-		std::visit([in, in_len](auto& v) { v.handle_publish_mecha_setting(in, in_len); }, handler);
+	void handle_publish_mecha_setting(MessageView msg) {
+		std::visit([msg](auto& v) { v.handle_publish_mecha_setting(msg); }, handler);
 	}
-	void handle_publish_mecha_status(const std::byte* in, size_t in_len) {
-		std::visit([in, in_len](auto& v) { v.handle_publish_mecha_status(in, in_len); }, handler);
+	void handle_publish_mecha_status(MessageView msg) {
+		std::visit([msg](auto& v) { v.handle_publish_mecha_status(msg); }, handler);
 	}
-	void handle_response_mecha_status(const std::byte* in, size_t in_len) {
-		std::visit([in, in_len](auto& v) { v.handle_response_mecha_status(in, in_len); }, handler);
+	void handle_response_mecha_status(MessageView msg) {
+		std::visit([msg](auto& v) { v.handle_response_mecha_status(msg); }, handler);
 	}
-	void handle_history(const std::byte* in, size_t in_len) {
-		std::visit([in, in_len](auto& v) { v.handle_history(in, in_len); }, handler);
+	void handle_history(MessageView msg) {
+		std::visit([msg](auto& v) { v.handle_history(msg); }, handler);
 	}
 	size_t get_cmd_tag_size(size_t tag_len) const {
 		return std::visit([tag_len](auto& v) { return v.get_cmd_tag_size(tag_len); }, handler);
@@ -4,6 +4,55 @@
 
 namespace libsesame3bt::core {
 
+/**
+ * @brief A fragment (one BLE write) of a message
+ *
+ */
+struct tx_fragment_t {
+	const uint8_t* data;
+	size_t size;
+};
+
+/**
+ * @brief A received notification (or write)
+ *
+ */
+struct rx_packet_t {
+	const std::byte* data;
+	size_t size;
+};
+
+/**
+ * @brief Counters of a connection (transport)
+ * Histogram bin 0 counts < 1 ms, bin i counts [2^(i-1), 2^i) ms, the last bin counts everything above.
+ * Histograms are counted only if the backend implements get_time_ms().
+ */
+struct transport_stats_t {
+	static constexpr size_t HISTOGRAM_BINS = 8;
+
+	uint32_t tx_messages;
+	uint32_t tx_fragments;
+	uint32_t tx_bytes;
+	uint32_t tx_queued;    // fragments queued because the backend did not accept
+	uint32_t tx_rejected;  // messages not sent (queue full or write failure)
+
+	uint32_t rx_fragments;
+	uint32_t rx_bytes;
+	uint32_t rx_received;      // complete messages
+	uint32_t rx_require_more;  // fragments waiting for the rest of the message
+	uint32_t rx_skipping;      // fragments of discarded messages
+	uint32_t rx_dropped;       // fragments without payload
+	uint32_t rx_oversize;      // message too long or no receive buffer available
+	uint32_t rx_auth_failed;
+	uint32_t rx_undecryptable;  // too short or before key sharing
+	uint32_t rx_bad_kind;
+
+	uint32_t fragment_gap[HISTOGRAM_BINS];     // between fragments of a message
+	uint32_t reassembly_time[HISTOGRAM_BINS];  // first to last fragment of multi-fragment message
+
+	transport_stats_t& operator+=(const transport_stats_t& that);
+};
+
 /**
  * @brief BLE communication backend interface
  *
@@ -19,6 +68,61 @@ class SesameBLEBackend {
 	 * @return false Failure
 	 */
 	virtual bool write_to_tx(const uint8_t* data, size_t size) = 0;
+	/**
+	 * @brief Send fragments of a message to SESAME Tx characteristic
+	 * @note Default implementation calls write_to_tx() for each fragment and stops at the first failure.
+	 * Override this if the BLE stack can queue multiple writes at once.
+	 * Fragments not accepted are kept in the transport queue and passed again later (see SesameClientCore::on_tx_ready()).
+	 *
+	 * @param fragments fragments to send (in order)
+	 * @param count number of fragments
+	 * @return size_t number of fragments accepted (from the beginning)
+	 */
+	virtual size_t write_fragments_to_tx(const tx_fragment_t* fragments, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			if (!write_to_tx(fragments[i].data, fragments[i].size)) {
+				return i;
+			}
+		}
+		return count;
+	}
+	/**
+	 * @brief Lease a writable buffer for a fragment (optional)
+	 * Implement this to let the fragment be built directly in the BLE stack's buffer (e.g. NimBLE os_mbuf).
+	 * Leased buffer is passed to commit_tx_buffer() or cancel_tx_buffer() later.
+	 * @note Default implementation returns nullptr (not supported, write_fragments_to_tx() is used).
+	 *
+	 * @param size size of the fragment
+	 * @return uint8_t* buffer at least size bytes, nullptr if not available
+	 */
+	virtual uint8_t* lease_tx_buffer(size_t /*size*/) { return nullptr; }
+	/**
+	 * @brief Send leased buffer to SESAME Tx characteristic
+	 * Leased buffers of a message are committed in order.
+	 *
+	 * @param buffer buffer returned by lease_tx_buffer()
+	 * @param size size of data
+	 * @return true Success
+	 * @return false Failure, buffer is still leased (fragments from this one are queued and then cancel_tx_buffer() is called)
+	 */
+	virtual bool commit_tx_buffer(uint8_t* /*buffer*/, size_t /*size*/) { return false; }
+	/**
+	 * @brief Return leased buffer without sending
+	 *
+	 * @param buffer buffer returned by lease_tx_buffer()
+	 */
+	virtual void cancel_tx_buffer(uint8_t* /*buffer*/) {}
+	/**
+	 * @brief Current time in milliseconds (optional)
+	 * Used for timing histograms of transport_stats_t and the lifetime of SesameClientCore::set_shared_secret_reuse().
+	 * The value may wrap around.
+	 * @note Default implementation returns false (no clock, histograms are not counted).
+	 *
+	 * @param now current time
+	 * @return true now is set
+	 * @return false Clock not available
+	 */
+	virtual bool get_time_ms(uint32_t& /*now*/) { return false; }
 	/**
 	 * @brief Disconnect BLE connection
 	 *
@@ -29,6 +133,38 @@ class SesameBLEBackend {
 class ServerBLEBackend {
  public:
 	virtual bool write_to_central(uint16_t session_id, const uint8_t* data, size_t size) = 0;
+	/**
+	 * @brief Send fragments of a message to the central
+	 * @note Default implementation calls write_to_central() for each fragment and stops at the first failure.
+	 * @return size_t number of fragments accepted (from the beginning)
+	 */
+	virtual size_t write_fragments_to_central(uint16_t session_id, const tx_fragment_t* fragments, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			if (!write_to_central(session_id, fragments[i].data, fragments[i].size)) {
+				return i;
+			}
+		}
+		return count;
+	}
+	/**
+	 * @brief Lease a writable buffer for a fragment (optional)
+	 * @note Same as SesameBLEBackend::lease_tx_buffer(). Default implementation returns nullptr (not supported).
+	 */
+	virtual uint8_t* lease_central_buffer(uint16_t /*session_id*/, size_t /*size*/) { return nullptr; }
+	/**
+	 * @brief Send leased buffer to the central
+	 * @note Same as SesameBLEBackend::commit_tx_buffer().
+	 */
+	virtual bool commit_central_buffer(uint16_t /*session_id*/, uint8_t* /*buffer*/, size_t /*size*/) { return false; }
+	/**
+	 * @brief Return leased buffer without sending
+	 */
+	virtual void cancel_central_buffer(uint16_t /*session_id*/, uint8_t* /*buffer*/) {}
+	/**
+	 * @brief Current time in milliseconds (optional)
+	 * @note Same as SesameBLEBackend::get_time_ms(). Default implementation returns false (no clock).
+	 */
+	virtual bool get_time_ms(uint32_t& /*now*/) { return false; }
 	virtual void disconnect(uint16_t session_id) = 0;
 };
 
@@ -237,7 +237,7 @@ using registered_devices_callback_t = std::function<void(SesameClientCore& clien
  */
 class SesameClientCore {
  public:
-	SesameClientCore(SesameBLEBackend&);
+	SesameClientCore(SesameBLEBackend& backend, size_t tx_queue_size = 0);
 	SesameClientCore(const SesameClientCore&) = delete;
 	SesameClientCore& operator=(const SesameClientCore&) = delete;
 	virtual ~SesameClientCore();
@@ -263,9 +263,23 @@ class SesameClientCore {
 	const std::variant<std::nullptr_t, LockSetting, BotSetting>& get_setting() const;
 	bool has_setting() const;
 	bool request_status();
+	void set_iv_resync_window(uint8_t window);
+	uint32_t get_iv_resync_count() const;
+	void set_keystream_precompute(bool enable);
+	void set_restartable_handshake(bool enable);
+	void set_handshake_precompute(bool enable);
+	void set_shared_secret_reuse(uint16_t max_reuse, uint32_t lifetime_msec = 0);
+	uint32_t get_shared_secret_reuse_count() const;
+	void update();
 
 	void on_received(const std::byte*, size_t);
+	void on_received_batch(const rx_packet_t* packets, size_t count);
 	void on_disconnected();
+	void on_mtu_changed(uint16_t mtu);
+	bool on_tx_ready();
+	size_t get_tx_queue_depth() const;
+	const transport_stats_t& get_transport_stats() const;
+	void reset_transport_stats();
 
  private:
 	std::unique_ptr<SesameClientCoreImpl> impl;
@@ -29,7 +29,7 @@ enum flags : uint8_t {
 
 class SesameServerCore {
  public:
-	SesameServerCore(ServerBLEBackend& backend, int max_sessions);
+	SesameServerCore(ServerBLEBackend& backend, int max_sessions, int recv_buffers = 0, size_t tx_queue_size = 0);
 	SesameServerCore(const SesameServerCore&) = delete;
 	SesameServerCore& operator=(const SesameServerCore&) = delete;
 	virtual ~SesameServerCore();
@@ -40,7 +40,13 @@ class SesameServerCore {
 	bool set_registered(const std::array<std::byte, Sesame::SECRET_SIZE>& secret);
 	bool on_subscribed(uint16_t session_id);
 	bool on_received(uint16_t session_id, const std::byte*, size_t);
+	bool on_received_batch(uint16_t session_id, const rx_packet_t* packets, size_t count);
 	void on_disconnected(uint16_t session_id);
+	bool on_mtu_changed(uint16_t session_id, uint16_t mtu);
+	bool on_tx_ready(uint16_t session_id);
+	size_t get_tx_queue_depth(uint16_t session_id) const;
+	transport_stats_t get_transport_stats(std::optional<uint16_t> session_id = std::nullopt) const;
+	void reset_transport_stats();
 	bool is_registered() const;
 	bool has_session(uint16_t session_id) const;
 	size_t get_session_count() const;
@@ -56,6 +62,9 @@ class SesameServerCore {
 	void set_mecha_setting(const Sesame::mecha_setting_5_t& setting);
 	void set_mecha_status(const Sesame::mecha_status_5_t& status);
 	void set_auto_send_flags(auto_send::flags flags);
+	void set_iv_resync_window(uint8_t window);
+	uint32_t get_iv_resync_count() const;
+	void set_keystream_precompute(bool enable);
 
 	std::tuple<std::string, std::string> create_advertisement_data_os3() const;
 
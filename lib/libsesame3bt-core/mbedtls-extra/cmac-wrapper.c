@@ -1,4 +0,0 @@
-#if !defined(USE_FRAMEWORK_MBEDTLS_CMAC)
-#define MBEDTLS_CMAC_C
-#include "cmac.c.include"
-#endif
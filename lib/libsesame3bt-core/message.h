@@ -0,0 +1,48 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+
+namespace libsesame3bt::core {
+
+/**
+ * @brief Bounds checked view of a received message
+ * Refers to the transport buffer (no copy), valid while the received message is.
+ */
+class MessageView {
+ public:
+	constexpr MessageView(const std::byte* data, size_t size) : _data(data), _size(size) {}
+	const std::byte* data() const { return _data; }
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	/// @note Not checked, check size() first.
+	std::byte operator[](size_t pos) const { return _data[pos]; }
+
+	/// @brief Message as packed structure T
+	/// @return nullptr if the message is shorter than T
+	template <typename T>
+	const T* as() const {
+		static_assert(alignof(T) == 1, "T must be packed");
+		return _size >= sizeof(T) ? reinterpret_cast<const T*>(_data) : nullptr;
+	}
+	/// @brief Remaining part after offset bytes (empty if the message is shorter)
+	MessageView skip(size_t offset) const {
+		offset = std::min(offset, _size);
+		return {_data + offset, _size - offset};
+	}
+	/// @brief Remaining part after structure T
+	template <typename T>
+	MessageView after() const {
+		return skip(sizeof(T));
+	}
+	std::string_view as_string(size_t offset, size_t count) const {
+		auto v = skip(offset);
+		return {reinterpret_cast<const char*>(v._data), std::min(count, v._size)};
+	}
+
+ private:
+	const std::byte* _data;
+	size_t _size;
+};
+
+}  // namespace libsesame3bt::core
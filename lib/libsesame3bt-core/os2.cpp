@@ -13,7 +13,6 @@ namespace libsesame3bt::core {
 namespace {
 
 constexpr size_t AUTH_TAG_TRUNCATED_SIZE = 4;
-constexpr size_t AES_KEY_SIZE = 16;
 constexpr size_t IV_COUNTER_SIZE = 5;
 
 }  // namespace
@@ -42,9 +41,13 @@ OS2Handler::set_keys(std::string_view pk_str, std::string_view secret_str) {
 bool
 OS2Handler::set_keys(const std::array<std::byte, Sesame::PK_SIZE>& public_key,
                      const std::array<std::byte, Sesame::SECRET_SIZE>& secret_key) {
-	if (!ecc.convert_binary_to_pk(public_key, sesame_pk)) {
+	if (!Ecc::check_pk(public_key)) {
 		return false;
 	}
+	abort_handshake();
+	discard_pool();
+	discard_reuse();
+	sesame_pk = public_key;
 	std::copy(std::cbegin(secret_key), std::cend(secret_key), std::begin(sesame_secret));
 	client->_is_key_set = true;
 
@@ -61,90 +64,278 @@ OS2Handler::send_command(Sesame::op_code_t op_code,
 }
 
 void
-OS2Handler::handle_publish_initial(const std::byte* in, size_t in_len) {
-	if (in_len < sizeof(Sesame::publish_initial_t)) {
-		DEBUG_PRINTF("%u: short response initial data\n", in_len);
+OS2Handler::handle_publish_initial(MessageView msg) {
+	const auto* initial = msg.as<Sesame::publish_initial_t>();
+	if (!initial) {
+		DEBUG_PRINTF("%zu: short response initial data\n", msg.size());
 		client->disconnect();
 		return;
 	}
 	crypt.reset_session_key();
-	auto msg = reinterpret_cast<const Sesame::publish_initial_t*>(in);
+	reset();
 
-	std::array<std::byte, Sesame::TOKEN_SIZE> local_tok;
-	if (!Random::get_random(local_tok)) {
-		client->disconnect();
+	std::copy(std::cbegin(initial->token), std::cend(initial->token), std::begin(sesame_tok));
+	login_pending = true;
+	expire_reuse();
+	if (is_reusable() || pool_count > 0) {
+		if (!(is_reusable() ? send_login_reused() : send_login_fresh())) {
+			client->disconnect();
+		}
 		return;
 	}
+	if (handshake == handshake_t::idle) {
+		handshake = handshake_t::keypair;
+	}
+	if (!client->restartable_handshake) {
+		advance_handshake();
+	}
+}
 
-	std::array<std::byte, Sesame::PK_SIZE> bpk;
-	if (!generate_session_key(local_tok, msg->token, bpk)) {
-		client->disconnect();
-		return;
+void
+OS2Handler::update() {
+	expire_reuse();
+	if (handshake == handshake_t::idle && !login_pending && client->handshake_precompute && client->_is_key_set &&
+	    pool_count < pool.size() && !is_reusable()) {
+		handshake = handshake_t::keypair;
+	}
+	if (handshake != handshake_t::idle) {
+		advance_handshake();
+	}
+}
+
+void
+OS2Handler::reset() {
+	login_pending = false;
+	if (!client->handshake_precompute) {
+		abort_handshake();
+	}
+}
+
+void
+OS2Handler::abort_handshake() {
+	handshake = handshake_t::idle;
+	ecc.abort_step();
+}
+
+// whole handshake at once, or one slice per update() with restartable handshake
+void
+OS2Handler::advance_handshake() {
+	do {
+		if (!step_handshake()) {
+			abort_handshake();
+			if (login_pending) {
+				client->disconnect();
+			}
+			return;
+		}
+	} while (handshake != handshake_t::idle && !client->restartable_handshake);
+}
+
+bool
+OS2Handler::step_handshake() {
+	switch (handshake) {
+		case handshake_t::keypair:
+			switch (ecc.generate_keypair_step()) {
+				case Ecc::step_result_t::failed:
+					return false;
+				case Ecc::step_result_t::done:
+					handshake = handshake_t::ecdh;
+					break;
+				default:
+					break;
+			}
+			return true;
+		case handshake_t::ecdh: {
+			std::array<std::byte, Ecc::SK_SIZE> ssec;
+			switch (ecc.ecdh_step(sesame_pk, ssec)) {
+				case Ecc::step_result_t::failed:
+					return false;
+				case Ecc::step_result_t::done: {
+					handshake = handshake_t::idle;
+					bool stored = store_material(ssec);
+					zeroize(ssec.data(), ssec.size());
+					return stored && (!login_pending || send_login_fresh());
+				}
+				default:
+					return true;
+			}
+		}
+		default:
+			return true;
+	}
+}
+
+bool
+OS2Handler::store_material(const std::array<std::byte, Ecc::SK_SIZE>& ssec) {
+	auto& m = pool[pool_count];
+	if (!ecc.export_pk(m.pk) || !Random::get_random(m.local_tok)) {
+		return false;
+	}
+	std::copy(ssec.cbegin(), ssec.cbegin() + m.secret.size(), m.secret.begin());
+	if (!start_cmacs(m.secret, m.pk, m.local_tok, m.session_cmac, m.tag_cmac)) {
+		m.wipe();
+		return false;
+	}
+	pool_count++;
+	return true;
+}
+
+void
+OS2Handler::discard_pool() {
+	for (auto& m : pool) {
+		m.wipe();
+	}
+	pool_count = 0;
+}
+
+// session_key = CMAC(ssec[:16], local_tok + sesame_tok), tag = CMAC(sesame_secret, sesame_ki + pk + local_tok + sesame_tok)
+bool
+OS2Handler::start_cmacs(const std::array<std::byte, AES_KEY_SIZE>& secret,
+                        const std::array<std::byte, Sesame::PK_SIZE>& pk,
+                        const std::array<std::byte, Sesame::TOKEN_SIZE>& local_tok,
+                        CmacAes128& session_cmac,
+                        CmacAes128& tag_cmac) {
+	return session_cmac.set_key(secret) && session_cmac.update(local_tok) && tag_cmac.set_key(sesame_secret) &&
+	       tag_cmac.update(sesame_ki) && tag_cmac.update(pk) && tag_cmac.update(local_tok);
+}
+
+bool
+OS2Handler::is_reusable() const {
+	if (reuse_logins == 0 || reuse_logins > client->secret_reuse_max) {
+		return false;
+	}
+	uint32_t now;
+	return client->secret_reuse_lifetime == 0 ||
+	       (transport.get_time_ms(now) && now - reuse_since < client->secret_reuse_lifetime);
+}
+
+void
+OS2Handler::discard_reuse() {
+	zeroize(reuse_pk.data(), reuse_pk.size());
+	zeroize(reuse_secret.data(), reuse_secret.size());
+	reuse_logins = 0;
+}
+
+// wipe the reused secret as soon as the policy (count or lifetime) stops allowing it
+void
+OS2Handler::expire_reuse() {
+	if (reuse_logins > 0 && !is_reusable()) {
+		discard_reuse();
+	}
+}
+
+bool
+OS2Handler::send_login_fresh() {
+	auto& m = pool[--pool_count];
+	// lifetime is measured with the backend clock, without it the result is kept only for unlimited lifetime
+	const bool timed = transport.get_time_ms(reuse_since);
+	if (client->secret_reuse_max > 0 && (timed || client->secret_reuse_lifetime == 0)) {
+		reuse_pk = m.pk;
+		reuse_secret = m.secret;
+		reuse_logins = 1;
+	} else {
+		discard_reuse();
+	}
+	bool rc = send_login(m.pk, m.local_tok, m.session_cmac, m.tag_cmac);
+	m.wipe();
+	return rc;
+}
+
+// same key pair and ECDH result as the previous login, new local token
+bool
+OS2Handler::send_login_reused() {
+	std::array<std::byte, Sesame::TOKEN_SIZE> local_tok;
+	CmacAes128 session_cmac;
+	CmacAes128 tag_cmac;
+	if (!Random::get_random(local_tok) || !start_cmacs(reuse_secret, reuse_pk, local_tok, session_cmac, tag_cmac)) {
+		return false;
+	}
+	reuse_logins++;
+	client->secret_reuse_count++;
+	bool rc = send_login(reuse_pk, local_tok, session_cmac, tag_cmac);
+	expire_reuse();
+	return rc;
+}
+
+bool
+OS2Handler::send_login(const std::array<std::byte, Sesame::PK_SIZE>& pk,
+                       const std::array<std::byte, Sesame::TOKEN_SIZE>& local_tok,
+                       CmacAes128& session_cmac,
+                       CmacAes128& tag_cmac) {
+	std::array<std::byte, AES_KEY_SIZE> session_key;
+	bool keyed = session_cmac.update(sesame_tok) && session_cmac.finish(session_key) &&
+	             crypt.set_session_key(session_key.data(), session_key.size(), local_tok, sesame_tok);
+	zeroize(session_key.data(), session_key.size());
+	if (!keyed) {
+		return false;
 	}
 	std::array<std::byte, AES_BLOCK_SIZE> tag_response;
-	if (!generate_tag_response(bpk, local_tok, msg->token, tag_response)) {
-		client->disconnect();
-		return;
+	if (!tag_cmac.update(sesame_tok) || !tag_cmac.finish(tag_response)) {
+		return false;
 	}
 
-	constexpr size_t resp_size = sesame_ki.size() + Sesame::PK_SIZE + local_tok.size() + AUTH_TAG_TRUNCATED_SIZE;
+	constexpr size_t resp_size = sesame_ki.size() + Sesame::PK_SIZE + Sesame::TOKEN_SIZE + AUTH_TAG_TRUNCATED_SIZE;
 	std::array<std::byte, resp_size> resp;
 
 	// resp = sesame_ki + pk + local_tok + tag_response[:4]
 	std::copy(tag_response.cbegin(), tag_response.cbegin() + AUTH_TAG_TRUNCATED_SIZE,
 	          std::copy(local_tok.cbegin(), local_tok.cend(),
-	                    std::copy(bpk.begin(), bpk.end(), std::copy(sesame_ki.cbegin(), sesame_ki.cend(), resp.begin()))));
+	                    std::copy(pk.begin(), pk.end(), std::copy(sesame_ki.cbegin(), sesame_ki.cend(), resp.begin()))));
 
-	if (send_command(Sesame::op_code_t::sync, Sesame::item_code_t::login, resp.data(), resp.size(), false)) {
-		client->update_state(state_t::authenticating);
-	} else {
-		client->disconnect();
+	login_pending = false;
+	if (!send_command(Sesame::op_code_t::sync, Sesame::item_code_t::login, resp.data(), resp.size(), false)) {
+		return false;
 	}
+	client->update_state(state_t::authenticating);
+	return true;
 }
 
 void
-OS2Handler::handle_response_login(const std::byte* in, size_t in_len) {
-	if (in_len < sizeof(Sesame::response_login_t)) {
+OS2Handler::handle_response_login(MessageView msg) {
+	const auto* login = msg.as<Sesame::response_login_t>();
+	if (!login) {
 		DEBUG_PRINTLN("short response login message");
 		client->disconnect();
 		return;
 	}
-	auto msg = reinterpret_cast<const Sesame::response_login_t*>(in);
-	if (msg->result != Sesame::result_code_t::success) {
-		DEBUG_PRINTF("%u: login response was not success\n", static_cast<uint8_t>(msg->result));
+	if (login->result != Sesame::result_code_t::success) {
+		DEBUG_PRINTF("%u: login response was not success\n", static_cast<uint8_t>(login->result));
+		// precomputed material is for the same keys, do not keep it either
+		discard_pool();
+		discard_reuse();
 		client->disconnect();
 		return;
 	}
 	if (client->model == Sesame::model_t::sesame_bot) {
-		client->setting.emplace<BotSetting>(msg->mecha_setting);
+		client->setting.emplace<BotSetting>(login->mecha_setting);
 	} else {
-		client->setting.emplace<LockSetting>(msg->mecha_setting);
+		client->setting.emplace<LockSetting>(login->mecha_setting);
 	}
-	update_sesame_status(msg->mecha_status);
+	update_sesame_status(login->mecha_status);
 	client->update_state(state_t::active);
 	client->fire_status_callback();
 }
 
 void
-OS2Handler::handle_history(const std::byte* in, size_t in_len) {
+OS2Handler::handle_history(MessageView msg) {
 	History history{};
-	if (in_len < 2) {
-		DEBUG_PRINTLN("%u: Unexpected size of history response, ignored", in_len);
+	if (msg.size() < 2) {
+		DEBUG_PRINTLN("%zu: Unexpected size of history response, ignored", msg.size());
 		return;
 	}
-	history.result = static_cast<Sesame::result_code_t>(in[1]);
-	if (history.result != Sesame::result_code_t::success || in_len < sizeof(Sesame::response_history_t)) {
+	history.result = static_cast<Sesame::result_code_t>(msg[1]);
+	const auto* hist = msg.as<Sesame::response_history_t>();
+	if (history.result != Sesame::result_code_t::success || !hist) {
 		DEBUG_PRINTLN("%u: Empty history response", static_cast<uint8_t>(history.result));
 		client->fire_history_callback(history);
 		return;
 	}
-	const auto* hist = reinterpret_cast<const Sesame::response_history_t*>(in);
 	history.time = static_cast<time_t>(hist->timestamp / 1000);
 	history.record_id = hist->record_id;
 	auto histtype = hist->type;
 	constexpr size_t SKIP_SIZE = 18;
-	if (in_len > sizeof(Sesame::response_history_t) + SKIP_SIZE) {
-		const auto* tag_data = reinterpret_cast<const char*>(in + sizeof(Sesame::response_history_t) + SKIP_SIZE);
+	if (auto tag = msg.after<Sesame::response_history_t>().skip(SKIP_SIZE); !tag.empty()) {
+		const auto* tag_data = reinterpret_cast<const char*>(tag.data());
 		uint8_t tag_len = tag_data[0];
 		if (histtype == Sesame::history_type_t::ble_lock || histtype == Sesame::history_type_t::ble_unlock) {
 			if (tag_len >= 60) {
@@ -158,7 +349,7 @@ OS2Handler::handle_history(const std::byte* in, size_t in_len) {
 			}
 		}
 		tag_len = std::min<uint8_t>(tag_len, get_max_history_tag_size());
-		auto tag_str = util::cleanup_tail_utf8({tag_data + 1, tag_len});
+		auto tag_str = util::cleanup_tail_utf8(tag.as_string(1, tag_len));
 		history.tag_len = tag_str.length();
 		*std::copy(std::begin(tag_str), std::end(tag_str), history.tag) = 0;
 	} else {
@@ -178,88 +369,28 @@ OS2Handler::update_sesame_status(const Sesame::mecha_status_t& mecha_status) {
 	}
 }
 void
-OS2Handler::handle_publish_mecha_setting(const std::byte* in, size_t in_len) {
-	if (in_len < sizeof(Sesame::publish_mecha_setting_t)) {
-		DEBUG_PRINTF("%u: Unexpected size of mecha setting, ignored\n", in_len);
+OS2Handler::handle_publish_mecha_setting(MessageView msg) {
+	const auto* setting = msg.as<Sesame::publish_mecha_setting_t>();
+	if (!setting) {
+		DEBUG_PRINTF("%zu: Unexpected size of mecha setting, ignored\n", msg.size());
 		return;
 	}
-	auto msg = reinterpret_cast<const Sesame::publish_mecha_setting_t*>(in);
 	if (client->model == Sesame::model_t::sesame_bot) {
-		client->setting.emplace<BotSetting>(msg->setting);
+		client->setting.emplace<BotSetting>(setting->setting);
 	} else {
-		client->setting.emplace<LockSetting>(msg->setting);
+		client->setting.emplace<LockSetting>(setting->setting);
 	}
 }
 
 void
-OS2Handler::handle_publish_mecha_status(const std::byte* in, size_t in_len) {
-	if (in_len < sizeof(Sesame::publish_mecha_status_t)) {
-		DEBUG_PRINTF("%u: Unexpected size of mecha status, ignored\n", in_len);
+OS2Handler::handle_publish_mecha_status(MessageView msg) {
+	const auto* status = msg.as<Sesame::publish_mecha_status_t>();
+	if (!status) {
+		DEBUG_PRINTF("%zu: Unexpected size of mecha status, ignored\n", msg.size());
 		return;
 	}
-	auto msg = reinterpret_cast<const Sesame::publish_mecha_status_t*>(in);
-	update_sesame_status(msg->status);
+	update_sesame_status(status->status);
 	client->fire_status_callback();
 }
 
-bool
-OS2Handler::generate_session_key(const std::array<std::byte, Sesame::TOKEN_SIZE>& local_tok,
-                                 const std::byte (&sesame_token)[Sesame::TOKEN_SIZE],
-                                 std::array<std::byte, Sesame::PK_SIZE>& pk) {
-	if (!create_key_pair(pk)) {
-		return false;
-	}
-	std::array<std::byte, Ecc::SK_SIZE> ssec;
-	if (!ecdh(ssec)) {
-		return false;
-	}
-
-	CmacAes128 cmac;
-	std::array<std::byte, 16> session_key;
-	if (!cmac.set_key(*reinterpret_cast<const std::byte(*)[AES_KEY_SIZE]>(ssec.data())) || !cmac.update(local_tok) ||
-	    !cmac.update(sesame_token) || !cmac.finish(session_key)) {
-		return false;
-	}
-	if (!crypt.set_session_key(session_key.data(), session_key.size(), local_tok, sesame_token)) {
-		return false;
-	}
-	return true;
-}
-
-bool
-OS2Handler::create_key_pair(std::array<std::byte, Sesame::PK_SIZE>& bin_pk) {
-	if (!ecc.generate_keypair()) {
-		return false;
-	}
-	if (!ecc.export_pk(bin_pk)) {
-		return false;
-	}
-	return true;
-}
-
-bool
-OS2Handler::ecdh(std::array<std::byte, Ecc::SK_SIZE>& out) {
-	api_wrapper<mbedtls_mpi> shared_secret(mbedtls_mpi_init, mbedtls_mpi_free);
-	if (!ecc.ecdh(sesame_pk, shared_secret)) {
-		return false;
-	}
-	if (!ecc.convert_sk_to_binary(shared_secret, out)) {
-		return false;
-	}
-	return true;
-}
-
-bool
-OS2Handler::generate_tag_response(const std::array<std::byte, Sesame::PK_SIZE>& bpk,
-                                  const std::array<std::byte, Sesame::TOKEN_SIZE>& local_tok,
-                                  const std::byte (&sesame_token)[4],
-                                  std::array<std::byte, AES_BLOCK_SIZE>& tag_response) {
-	CmacAes128 cmac;
-	if (!cmac.set_key(sesame_secret) || !cmac.update(sesame_ki) || !cmac.update(bpk) || !cmac.update(local_tok) ||
-	    !cmac.update(sesame_token) || !cmac.finish(tag_response)) {
-		return false;
-	}
-	return true;
-}
-
 }  // namespace libsesame3bt::core
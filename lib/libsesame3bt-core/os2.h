@@ -5,16 +5,27 @@
 #include "Sesame.h"
 #include "crypt.h"
 #include "crypt_ecc.h"
+#include "message.h"
 #include "transport.h"
 
+#ifndef LIBSESAME3BTCORE_OS2_HANDSHAKE_POOL_SIZE
+#define LIBSESAME3BTCORE_OS2_HANDSHAKE_POOL_SIZE 1
+#endif
+static_assert(LIBSESAME3BTCORE_OS2_HANDSHAKE_POOL_SIZE > 0, "LIBSESAME3BTCORE_OS2_HANDSHAKE_POOL_SIZE must be positive");
+
 namespace libsesame3bt::core {
 
 class SesameClientCoreImpl;
 
 class OS2Handler {
  public:
-	OS2Handler(SesameClientCoreImpl* client, SesameBLETransport& transport, CryptHandler& crypt)
+	using crypt_t = BasicCryptHandler<OS2IVHandler, crypt_role_t::central>;
+	OS2Handler(SesameClientCoreImpl* client, SesameBLETransport& transport, crypt_t& crypt)
 	    : client(client), transport(transport), crypt(crypt) {}
+	~OS2Handler() {
+		discard_pool();
+		discard_reuse();
+	}
 	OS2Handler(const OS2Handler&) = delete;
 	OS2Handler& operator=(const OS2Handler&) = delete;
 	bool init() { return Ecc::initialized(); }
@@ -27,12 +38,14 @@ class OS2Handler {
 	                  size_t data_size,
 	                  bool is_crypted);
 
-	void handle_publish_initial(const std::byte* in, size_t in_len);
-	void handle_response_login(const std::byte* in, size_t in_len);
-	void handle_publish_mecha_setting(const std::byte* in, size_t in_len);
-	void handle_publish_mecha_status(const std::byte* in, size_t in_len);
-	void handle_response_mecha_status(const std::byte* in, size_t in_len) { handle_publish_mecha_status(in + 2, in_len - 2); };
-	void handle_history(const std::byte* in, size_t in_len);
+	void update();
+	void reset();
+	void handle_publish_initial(MessageView msg);
+	void handle_response_login(MessageView msg);
+	void handle_publish_mecha_setting(MessageView msg);
+	void handle_publish_mecha_status(MessageView msg);
+	void handle_response_mecha_status(MessageView msg) { handle_publish_mecha_status(msg.skip(2)); };
+	void handle_history(MessageView msg);
 	size_t get_max_history_tag_size() const { return MAX_HISTORY_TAG_SIZE; }
 	size_t get_cmd_tag_size(size_t tag_len) const { return MAX_HISTORY_TAG_SIZE + 1; }
 	static constexpr size_t MAX_HISTORY_TAG_SIZE = 21;
@@ -40,25 +53,65 @@ class OS2Handler {
  private:
 	SesameClientCoreImpl* client;
 	SesameBLETransport& transport;
-	CryptHandler& crypt;
+	crypt_t& crypt;
 	Ecc ecc;
-	api_wrapper<mbedtls_ecp_point> sesame_pk{mbedtls_ecp_point_init, mbedtls_ecp_point_free};
+	std::array<std::byte, Ecc::PK_SIZE> sesame_pk{};
 	std::array<std::byte, Sesame::SECRET_SIZE> sesame_secret{};
 	long long enc_count = 0;
 	long long dec_count = 0;
-
 	static constexpr std::array<std::byte, 2> sesame_ki{};
 	static constexpr size_t AES_BLOCK_SIZE = 16;
+	static constexpr size_t AES_KEY_SIZE = 16;
+
+	/*
+	 * Handshake material does not depend on the token of SESAME: ephemeral public key, local token and CMAC
+	 * states with everything but the SESAME token absorbed. An entry is used for one login only.
+	 */
+	struct handshake_material_t {
+		std::array<std::byte, Sesame::PK_SIZE> pk;
+		std::array<std::byte, Sesame::TOKEN_SIZE> local_tok;
+		std::array<std::byte, AES_KEY_SIZE> secret;  // ECDH secret (CMAC key part), kept for reuse
+		CmacAes128 session_cmac;  // ECDH secret key, local_tok
+		CmacAes128 tag_cmac;      // sesame_secret key, sesame_ki + pk + local_tok
+		void wipe() {
+			zeroize(pk.data(), pk.size());
+			zeroize(secret.data(), secret.size());
+			session_cmac.reset();
+			tag_cmac.reset();
+		}
+	};
+	std::array<handshake_material_t, LIBSESAME3BTCORE_OS2_HANDSHAKE_POOL_SIZE> pool;
+	size_t pool_count = 0;
+	// material generation: key pair generation and ECDH, advanced by update() when sliced
+	enum class handshake_t : uint8_t { idle, keypair, ecdh };
+	handshake_t handshake = handshake_t::idle;
+	bool login_pending = false;
+	std::byte sesame_tok[Sesame::TOKEN_SIZE];
+	// ECDH result of the last fresh login, reused by set_shared_secret_reuse() policy
+	std::array<std::byte, Sesame::PK_SIZE> reuse_pk;
+	std::array<std::byte, AES_KEY_SIZE> reuse_secret;
+	uint16_t reuse_logins = 0;
+	uint32_t reuse_since = 0;
 
-	bool generate_session_key(const std::array<std::byte, Sesame::TOKEN_SIZE>& local_tok,
-	                          const std::byte (&sesame_token)[Sesame::TOKEN_SIZE],
-	                          std::array<std::byte, Sesame::PK_SIZE>& pk);
-	bool ecdh(std::array<std::byte, Ecc::SK_SIZE>& out);
-	bool create_key_pair(std::array<std::byte, Sesame::PK_SIZE>& pk);
-	bool generate_tag_response(const std::array<std::byte, Sesame::PK_SIZE>& pk,
-	                           const std::array<std::byte, Sesame::TOKEN_SIZE>& local_token,
-	                           const std::byte (&sesame_token)[Sesame::TOKEN_SIZE],
-	                           std::array<std::byte, AES_BLOCK_SIZE>& tag_response);
+	void advance_handshake();
+	bool step_handshake();
+	void abort_handshake();
+	bool store_material(const std::array<std::byte, Ecc::SK_SIZE>& ssec);
+	void discard_pool();
+	bool start_cmacs(const std::array<std::byte, AES_KEY_SIZE>& secret,
+	                 const std::array<std::byte, Sesame::PK_SIZE>& pk,
+	                 const std::array<std::byte, Sesame::TOKEN_SIZE>& local_tok,
+	                 CmacAes128& session_cmac,
+	                 CmacAes128& tag_cmac);
+	bool is_reusable() const;
+	void discard_reuse();
+	void expire_reuse();
+	bool send_login_fresh();
+	bool send_login_reused();
+	bool send_login(const std::array<std::byte, Sesame::PK_SIZE>& pk,
+	                const std::array<std::byte, Sesame::TOKEN_SIZE>& local_tok,
+	                CmacAes128& session_cmac,
+	                CmacAes128& tag_cmac);
 	void update_sesame_status(const Sesame::mecha_status_t& mecha_status);
 };
 
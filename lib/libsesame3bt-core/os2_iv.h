@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include "Sesame.h"
@@ -8,14 +9,26 @@ namespace libsesame3bt::core {
 class OS2IVHandler {
  public:
 	OS2IVHandler() {}
-	void update_c2p_iv(std::array<std::byte, 13>& c2p_iv);
-	void update_p2c_iv(std::array<std::byte, 13>& p2c_iv);
+	void update_c2p_iv(std::array<std::byte, 13>& c2p_iv) {
+		c2p_count++;
+		c2p_count &= 0x7fffffffffLL;
+		c2p_count |= 0x8000000000LL;
+		auto p = reinterpret_cast<const std::byte*>(&c2p_count);
+		std::copy(p, p + IV_COUNTER_SIZE, std::begin(c2p_iv));
+	}
+	void update_p2c_iv(std::array<std::byte, 13>& p2c_iv) {
+		p2c_count++;
+		p2c_count &= 0x7fffffffffLL;
+		auto p = reinterpret_cast<const std::byte*>(&p2c_count);
+		std::copy(p, p + IV_COUNTER_SIZE, std::begin(p2c_iv));
+	}
 	void init_ivs(const std::array<std::byte, Sesame::TOKEN_SIZE>& local_nonce,
 	              const std::byte (&remote_nonce)[Sesame::TOKEN_SIZE],
 	              std::array<std::byte, 13>& c2p_iv,
 	              std::array<std::byte, 13>& p2c_iv);
 
  private:
+	static constexpr size_t IV_COUNTER_SIZE = 5;
 	long long c2p_count = 0;
 	long long p2c_count = 0;
 };
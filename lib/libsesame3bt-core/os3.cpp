@@ -39,38 +39,25 @@ OS3Handler::send_command(Sesame::op_code_t op_code,
                          const std::byte* data,
                          size_t data_size,
                          bool is_crypted) {
-	const size_t pkt_size = 1 + data_size + (is_crypted ? Sesame::CMAC_TAG_SIZE : 0);  // 1 for item, 4 for encrypted tag
-	std::byte pkt[pkt_size];
-	if (is_crypted) {
-		std::byte plain[1 + data_size];
-		plain[0] = to_byte(item_code);
-		std::copy(data, data + data_size, &plain[1]);
-		if (!crypt.encrypt(plain, sizeof(plain), pkt, sizeof(pkt))) {
-			return false;
-		}
-	} else {
-		pkt[0] = to_byte(item_code);
-		std::copy(data, data + data_size, &pkt[1]);
-	}
-
-	return transport.send_data(pkt, pkt_size, is_crypted);
+	const std::byte head[]{to_byte(item_code)};
+	return transport.send_message(head, sizeof(head), data, data_size, is_crypted, crypt);
 }
 
 void
-OS3Handler::handle_publish_initial(const std::byte* in, size_t in_len) {
-	if (in_len < sizeof(Sesame::publish_initial_t)) {
-		DEBUG_PRINTLN("%u: short response initial data", in_len);
+OS3Handler::handle_publish_initial(MessageView msg) {
+	const auto* initial = msg.as<Sesame::publish_initial_t>();
+	if (!initial) {
+		DEBUG_PRINTLN("%zu: short response initial data", msg.size());
 		client->disconnect();
 		return;
 	}
-	const auto* msg = reinterpret_cast<const Sesame::publish_initial_t*>(in);
 	CmacAes128 cmac;
 	std::array<std::byte, 16> session_key;
-	if (!cmac.set_key(sesame_secret) || !cmac.update(msg->token) || !cmac.finish(session_key)) {
+	if (!cmac.set_key(sesame_secret) || !cmac.update(initial->token) || !cmac.finish(session_key)) {
 		client->disconnect();
 		return;
 	}
-	if (!crypt.set_session_key(session_key.data(), session_key.size(), {}, msg->token)) {
+	if (!crypt.set_session_key(session_key.data(), session_key.size(), {}, initial->token)) {
 		client->disconnect();
 		return;
 	}
@@ -82,19 +69,19 @@ OS3Handler::handle_publish_initial(const std::byte* in, size_t in_len) {
 }
 
 void
-OS3Handler::handle_response_login(const std::byte* in, size_t in_len) {
-	if (in_len < sizeof(Sesame::response_login_5_t)) {
+OS3Handler::handle_response_login(MessageView msg) {
+	const auto* login = msg.as<Sesame::response_login_5_t>();
+	if (!login) {
 		DEBUG_PRINTLN("short response login message");
 		client->disconnect();
 		return;
 	}
-	auto msg = reinterpret_cast<const Sesame::response_login_5_t*>(in);
-	if (msg->result != Sesame::result_code_t::success) {
-		DEBUG_PRINTLN("%u: login response was not success", static_cast<uint8_t>(msg->result));
+	if (login->result != Sesame::result_code_t::success) {
+		DEBUG_PRINTLN("%u: login response was not success", static_cast<uint8_t>(login->result));
 		client->disconnect();
 		return;
 	}
-	time_t t = msg->timestamp;
+	time_t t = login->timestamp;
 	struct tm tm;
 	gmtime_r(&t, &tm);
 	DEBUG_PRINTLN("time=%04d/%02d/%02d %02d:%02d:%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
@@ -104,13 +91,13 @@ OS3Handler::handle_response_login(const std::byte* in, size_t in_len) {
 }
 
 void
-OS3Handler::handle_publish_mecha_setting(const std::byte* in, size_t in_len) {
-	if (in_len < sizeof(Sesame::publish_mecha_setting_5_t)) {
-		DEBUG_PRINTLN("%u: Unexpected size of mecha setting, ignored", in_len);
+OS3Handler::handle_publish_mecha_setting(MessageView msg) {
+	const auto* setting = msg.as<Sesame::publish_mecha_setting_5_t>();
+	if (!setting) {
+		DEBUG_PRINTLN("%zu: Unexpected size of mecha setting, ignored", msg.size());
 		return;
 	}
-	auto msg = reinterpret_cast<const Sesame::publish_mecha_setting_5_t*>(in);
-	client->setting.emplace<LockSetting>(msg->setting);
+	client->setting.emplace<LockSetting>(setting->setting);
 	setting_received = true;
 	if (client->state != state_t::active && setting_received && status_received) {
 		client->update_state(state_t::active);
@@ -118,21 +105,19 @@ OS3Handler::handle_publish_mecha_setting(const std::byte* in, size_t in_len) {
 }
 
 void
-OS3Handler::handle_publish_mecha_status(const std::byte* in, size_t in_len) {
-	DEBUG_PRINTLN("status: %s", util::bin2hex(in, in_len).c_str());
-	if (client->model == Sesame::model_t::sesame_bot_2 && in_len == sizeof(Sesame::mecha_bot_2_status_t)) {
-		const auto* msg = reinterpret_cast<const Sesame::mecha_bot_2_status_t*>(in);
-		client->sesame_status = {*msg, client->model};
-	} else if (client->model == Sesame::model_t::sesame_bike_2 && in_len == sizeof(Sesame::mecha_bike_2_status_t)) {
-		const auto* msg = reinterpret_cast<const Sesame::mecha_bike_2_status_t*>(in);
-		client->sesame_status = {*msg, client->model};
+OS3Handler::handle_publish_mecha_status(MessageView msg) {
+	DEBUG_PRINTLN("status: %s", util::bin2hex(msg.data(), msg.size()).c_str());
+	if (client->model == Sesame::model_t::sesame_bot_2 && msg.size() == sizeof(Sesame::mecha_bot_2_status_t)) {
+		client->sesame_status = {*msg.as<Sesame::mecha_bot_2_status_t>(), client->model};
+	} else if (client->model == Sesame::model_t::sesame_bike_2 && msg.size() == sizeof(Sesame::mecha_bike_2_status_t)) {
+		client->sesame_status = {*msg.as<Sesame::mecha_bike_2_status_t>(), client->model};
 	} else {
-		if (in_len < sizeof(Sesame::publish_mecha_status_5_t)) {
-			DEBUG_PRINTF("%u: Unexpected size of mecha status, ignored", in_len);
+		const auto* status = msg.as<Sesame::publish_mecha_status_5_t>();
+		if (!status) {
+			DEBUG_PRINTF("%zu: Unexpected size of mecha status, ignored", msg.size());
 			return;
 		}
-		const auto* msg = reinterpret_cast<const Sesame::publish_mecha_status_5_t*>(in);
-		client->sesame_status = {msg->status, client->model};
+		client->sesame_status = {status->status, client->model};
 	}
 	client->fire_status_callback();
 	status_received = true;
@@ -142,24 +127,24 @@ OS3Handler::handle_publish_mecha_status(const std::byte* in, size_t in_len) {
 }
 
 void
-OS3Handler::handle_history(const std::byte* in, size_t in_len) {
+OS3Handler::handle_history(MessageView msg) {
 	History history{};
-	if (in_len < 1) {
-		DEBUG_PRINTLN("%u: Unexpected size of history response, ignored", in_len);
+	if (msg.empty()) {
+		DEBUG_PRINTLN("%zu: Unexpected size of history response, ignored", msg.size());
 		return;
 	}
-	history.result = static_cast<Sesame::result_code_t>(in[0]);
-	if (history.result != Sesame::result_code_t::success || in_len < sizeof(Sesame::response_history_5_t)) {
+	history.result = static_cast<Sesame::result_code_t>(msg[0]);
+	const auto* hist = msg.as<Sesame::response_history_5_t>();
+	if (history.result != Sesame::result_code_t::success || !hist) {
 		DEBUG_PRINTLN("%u: Empty history", static_cast<uint8_t>(history.result));
 		client->fire_history_callback(history);
 		return;
 	}
-	const auto* hist = reinterpret_cast<const Sesame::response_history_5_t*>(in);
 	history.time = hist->timestamp;
 	history.record_id = hist->record_id;
 	auto histtype = hist->type;
-	if (in_len > sizeof(Sesame::response_history_5_t)) {
-		const auto* tag_data = reinterpret_cast<const char*>(in + sizeof(Sesame::response_history_5_t));
+	if (auto tag = msg.after<Sesame::response_history_5_t>(); !tag.empty()) {
+		const auto* tag_data = reinterpret_cast<const char*>(tag.data());
 		uint8_t tag_len = tag_data[0];
 		if (histtype == Sesame::history_type_t::ble_lock || histtype == Sesame::history_type_t::ble_unlock) {
 			if (tag_len >= 60) {
@@ -174,22 +159,22 @@ OS3Handler::handle_history(const std::byte* in, size_t in_len) {
 		}
 		tag_len = std::min<uint8_t>(tag_len, get_max_history_tag_size());
 		if (tag_len > 0) {
-			auto tag_str = util::cleanup_tail_utf8({tag_data + 1, tag_len});
+			auto tag_str = util::cleanup_tail_utf8(tag.as_string(1, tag_len));
 			history.tag_len = tag_str.length();
 			*std::copy(std::begin(tag_str), std::end(tag_str), history.tag) = 0;
-		} else if (in_len >= sizeof(Sesame::response_history_5_t) + 18) {
+		} else if (tag.size() >= 18) {
 			history.history_tag_type = static_cast<history_tag_type_t>(tag_data[1]);
 			auto str = util::bin2hex(tag_data + 2, 16);
 			history.tag_len = str.length();
 			std::copy(str.cbegin(), str.cend(), history.tag);
-			if (in_len >= sizeof(Sesame::response_history_5_t) + 20) {
+			if (tag.size() >= 20) {
 				uint16_t voltage_raw = static_cast<uint8_t>(tag_data[19]) << 8 | static_cast<uint8_t>(tag_data[18]);
 				history.scaled_voltage = Status::status_value_to_scaled_voltage_os3(voltage_raw);
-				if (in_len >= sizeof(Sesame::response_history_5_t) + 22) {
+				if (tag.size() >= 22) {
 					uint16_t voltage_raw2 = static_cast<uint8_t>(tag_data[21]) << 8 | static_cast<uint8_t>(tag_data[20]);
 					history.scaled_voltage2 = Status::status_value_to_scaled_voltage_os3(voltage_raw2);
-					if (in_len >= sizeof(Sesame::response_history_5_t) + 23) {
-						history.extra = std::string_view(tag_data + 22, in_len - sizeof(Sesame::response_history_5_t) - 22);
+					if (tag.size() >= 23) {
+						history.extra = tag.as_string(22, tag.size() - 22);
 					}
 				}
 			}
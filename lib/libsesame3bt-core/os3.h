@@ -4,6 +4,7 @@
 #include <string_view>
 #include "Sesame.h"
 #include "crypt.h"
+#include "message.h"
 #include "transport.h"
 
 namespace libsesame3bt::core {
@@ -12,11 +13,14 @@ class SesameClientCoreImpl;
 
 class OS3Handler {
  public:
-	OS3Handler(SesameClientCoreImpl* client, SesameBLETransport& transport, CryptHandler& crypt)
+	using crypt_t = BasicCryptHandler<OS3IVHandler, crypt_role_t::central>;
+	OS3Handler(SesameClientCoreImpl* client, SesameBLETransport& transport, crypt_t& crypt)
 	    : client(client), transport(transport), crypt(crypt) {}
 	OS3Handler(const OS3Handler&) = delete;
 	OS3Handler& operator=(const OS3Handler&) = delete;
 	bool init() { return true; }
+	void update() {}
+	void reset() {}
 	bool set_keys(std::string_view pk_str, std::string_view secret_str);
 	bool set_keys(const std::array<std::byte, Sesame::PK_SIZE>& public_key,
 	              const std::array<std::byte, Sesame::SECRET_SIZE>& secret_key);
@@ -26,12 +30,12 @@ class OS3Handler {
 	                  size_t data_size,
 	                  bool is_crypted);
 
-	void handle_publish_initial(const std::byte* in, size_t in_len);
-	void handle_response_login(const std::byte* in, size_t in_len);
-	void handle_publish_mecha_setting(const std::byte* in, size_t in_len);
-	void handle_publish_mecha_status(const std::byte* in, size_t in_len);
-	void handle_response_mecha_status(const std::byte* in, size_t in_len) { handle_publish_mecha_status(in + 1, in_len - 1); };
-	void handle_history(const std::byte* in, size_t in_len);
+	void handle_publish_initial(MessageView msg);
+	void handle_response_login(MessageView msg);
+	void handle_publish_mecha_setting(MessageView msg);
+	void handle_publish_mecha_status(MessageView msg);
+	void handle_response_mecha_status(MessageView msg) { handle_publish_mecha_status(msg.skip(1)); };
+	void handle_history(MessageView msg);
 	size_t get_max_history_tag_size() const { return MAX_HISTORY_TAG_SIZE; }
 	size_t get_cmd_tag_size(size_t tag_len) const { return tag_len + 1; }
 	static constexpr size_t MAX_HISTORY_TAG_SIZE = 29;
@@ -39,7 +43,7 @@ class OS3Handler {
  private:
 	SesameClientCoreImpl* client;
 	SesameBLETransport& transport;
-	CryptHandler& crypt;
+	crypt_t& crypt;
 	std::array<std::byte, Sesame::SECRET_SIZE> sesame_secret{};
 	long long enc_count = 0;
 	long long dec_count = 0;
@@ -8,40 +8,258 @@ namespace libsesame3bt::core {
 
 using util::to_byte;
 using util::to_cptr;
+using util::to_ptr;
 
 namespace {
 
-constexpr size_t FRAGMENT_SIZE = 19;
+constexpr size_t ATT_HEADER_SIZE = 3;  // opcode + attribute handle
+constexpr size_t MAX_FLUSH_FRAGMENTS = 16;
 
 }
 
+/*
+ * Whether a message of pkt_size bytes is accepted by send_message() now.
+ * The whole message must fit in the queue, so a message is never sent partially.
+ * An empty message has no fragment to carry it and is never accepted.
+ * Without queue (size 0), messages are written directly as before.
+ */
 bool
-SesameBLETransport::send_data(const std::byte* pkt, size_t pkt_size, bool is_crypted) {
-	std::array<std::byte, 1 + FRAGMENT_SIZE> fragment;  // 1 for header
-	int pos = 0;
-	for (size_t remain = pkt_size; remain > 0;) {
-		fragment[0] = packet_header_t{
-		    pos == 0,
-		    remain > FRAGMENT_SIZE ? packet_kind_t::not_finished
-		    : is_crypted           ? packet_kind_t::encrypted
-		                           : packet_kind_t::plain,
+SesameBLETransport::can_send(size_t pkt_size) const {
+	if (pkt_size == 0 || pkt_size > MAX_SEND) {
+		return false;
+	}
+	const size_t nfragments = count_fragments(pkt_size);
+	if (tx_queue.get_capacity() == 0) {
+		return true;
+	}
+	return pkt_size + nfragments * (SesameBLETxQueue::ENTRY_HEADER_SIZE + 1) <= tx_queue.available();
+}
+
+/*
+ * can_send() and count the rejection. Call before encryption, rejected message must not advance IV.
+ */
+bool
+SesameBLETransport::prepare_send(size_t pkt_size) {
+	if (!can_send(pkt_size)) {
+		DEBUG_PRINTF("%zu: Message empty, too long or send queue full (%zu fragments), message not sent\n", pkt_size,
+		             tx_queue.size());
+		stats.tx_rejected++;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Message (head + data) is copied into the fragment payloads and encrypted there, fragment headers are filled around them.
+ * Fragments are built in buffers leased from the backend if possible, on the stack otherwise
+ * (the backend copies them or they are copied to the queue before returning).
+ */
+template <typename Crypt>
+bool
+SesameBLETransport::send_message(const std::byte* head,
+                                 size_t head_size,
+                                 const std::byte* data,
+                                 size_t data_size,
+                                 bool is_crypted,
+                                 Crypt& crypt) {
+	const size_t plain_size = head_size + data_size;
+	const size_t pkt_size = plain_size + (is_crypted ? CryptHandler::CMAC_TAG_SIZE : 0);
+	if (!prepare_send(pkt_size)) {
+		return false;
+	}
+	const size_t nfragments = count_fragments(pkt_size);
+	std::byte* frames[nfragments];
+	const bool leased = flush() && lease_frames(frames, nfragments, pkt_size);  // keep order with queued fragments
+	std::byte* payloads[nfragments];
+	std::byte tx_frames[leased ? 1 : pkt_size + nfragments];  // payload of each fragment follows 1 byte header
+	for (size_t i = 0; i < nfragments; i++) {
+		if (!leased) {
+			frames[i] = &tx_frames[i * (1 + fragment_size)];
+		}
+		frames[i][0] = packet_header_t{
+		    i == 0,
+		    pkt_size - i * fragment_size > fragment_size ? packet_kind_t::not_finished
+		    : is_crypted                                 ? packet_kind_t::encrypted
+		                                                 : packet_kind_t::plain,
 		    std::byte{0}}.value;
-		size_t ssz = std::min(remain, FRAGMENT_SIZE);
-		std::copy(pkt + pos, pkt + pos + ssz, &fragment[1]);
-		if (!backend.write_to_tx(to_cptr(fragment), ssz + 1)) {
-			DEBUG_PRINTLN("Failed to send data to the device");
+		payloads[i] = &frames[i][1];
+	}
+	chunked_buffer_t payload{payloads, fragment_size};
+	payload.write(0, head, head_size);
+	payload.write(head_size, data, data_size);
+	if (is_crypted && !crypt.encrypt(payload, plain_size)) {
+		if (leased) {
+			for (size_t i = 0; i < nfragments; i++) {
+				backend.cancel_tx_buffer(to_ptr(frames[i]));
+			}
+		}
+		stats.tx_rejected++;
+		return false;
+	}
+	return leased ? commit_frames(frames, nfragments, pkt_size) : transmit(frames, nfragments, pkt_size);
+}
+
+bool
+SesameBLETransport::lease_frames(std::byte** frames, size_t nfragments, size_t pkt_size) {
+	for (size_t i = 0; i < nfragments; i++) {
+		frames[i] = reinterpret_cast<std::byte*>(backend.lease_tx_buffer(frame_size(pkt_size, i)));
+		if (!frames[i]) {
+			for (size_t j = 0; j < i; j++) {
+				backend.cancel_tx_buffer(to_ptr(frames[j]));
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Commit leased fragments, fragments after a failed commit are copied to the queue.
+ */
+bool
+SesameBLETransport::commit_frames(std::byte* const* frames, size_t nfragments, size_t pkt_size) {
+	size_t sent = 0;
+	for (; sent < nfragments && backend.commit_tx_buffer(to_ptr(frames[sent]), frame_size(pkt_size, sent)); sent++) {
+	}
+	bool rc = sent == nfragments || tx_queue.get_capacity() > 0;
+	if (rc) {
+		count_sent(nfragments, pkt_size, nfragments - sent);
+	} else {
+		DEBUG_PRINTLN("Failed to send data to the device");
+		stats.tx_rejected++;
+	}
+	for (size_t i = sent; i < nfragments; i++) {
+		if (rc) {
+			tx_queue.push(frames[i], frame_size(pkt_size, i));
+		}
+		backend.cancel_tx_buffer(to_ptr(frames[i]));
+	}
+	return rc;
+}
+
+bool
+SesameBLETransport::transmit(std::byte* const* frames, size_t nfragments, size_t pkt_size) {
+	tx_fragment_t fragments[nfragments];
+	for (size_t i = 0; i < nfragments; i++) {
+		fragments[i] = {to_cptr(frames[i]), frame_size(pkt_size, i)};
+	}
+	size_t sent = tx_queue.empty() ? backend.write_fragments_to_tx(fragments, nfragments) : 0;
+	if (sent < nfragments && tx_queue.get_capacity() == 0) {
+		DEBUG_PRINTLN("Failed to send data to the device");
+		stats.tx_rejected++;
+		return false;
+	}
+	count_sent(nfragments, pkt_size, nfragments - sent);
+	for (; sent < nfragments; sent++) {
+		tx_queue.push(frames[sent], fragments[sent].size);
+	}
+	return true;
+}
+
+void
+SesameBLETransport::count_sent(size_t nfragments, size_t pkt_size, size_t queued) {
+	stats.tx_messages++;
+	stats.tx_fragments += static_cast<uint32_t>(nfragments);
+	stats.tx_bytes += static_cast<uint32_t>(pkt_size + nfragments);
+	stats.tx_queued += static_cast<uint32_t>(queued);
+}
+
+/*
+ * Pass queued fragments to the backend until it stops accepting.
+ * Returns true if the queue is empty.
+ */
+bool
+SesameBLETransport::flush() {
+	while (!tx_queue.empty()) {
+		tx_fragment_t fragments[MAX_FLUSH_FRAGMENTS];
+		size_t count = tx_queue.peek(fragments, std::size(fragments));
+		size_t sent = backend.write_fragments_to_tx(fragments, count);
+		tx_queue.pop(sent);
+		if (sent < count) {
 			return false;
 		}
-		pos += ssz;
-		remain -= ssz;
 	}
 	return true;
 }
 
 using decode_result_t = SesameBLETransport::decode_result_t;
 
+namespace {
+
+/*
+ * Bin 0: < 1 ms, bin i: [2^(i-1), 2^i) ms, last bin: above.
+ */
+void
+count_time(uint32_t (&histogram)[transport_stats_t::HISTOGRAM_BINS], uint32_t elapsed_ms) {
+	size_t bin = 0;
+	for (uint32_t ms = elapsed_ms; ms > 0 && bin < transport_stats_t::HISTOGRAM_BINS - 1; ms >>= 1) {
+		bin++;
+	}
+	histogram[bin]++;
+}
+
+template <typename Crypt>
+bool
+is_decryptable(size_t size, const Crypt& crypt) {
+	if (size < CryptHandler::CMAC_TAG_SIZE) {
+		DEBUG_PRINTLN("Encrypted message too short");
+		return false;
+	}
+	if (!crypt.is_key_shared()) {
+		DEBUG_PRINTLN("Encrypted message received before key sharing");
+		return false;
+	}
+	return true;
+}
+
+}  // namespace
+
+template <typename Crypt>
+decode_result_t
+SesameBLETransport::decode(const std::byte* p, size_t len, Crypt& crypt) {
+	stats.rx_fragments++;
+	stats.rx_bytes += static_cast<uint32_t>(len);
+	uint32_t now = 0;
+	const bool timed = backend.get_time_ms(now);
+	packet_header_t h{};
+	if (len > 0) {
+		h.value = p[0];
+	}
+	// timed only after the start fragment of the same message (not across lost fragments or connections)
+	const bool continued = timed && timing && !h.is_start;
+	if (continued) {
+		count_time(stats.fragment_gap, now - last_received);
+	}
+	if (h.is_start) {
+		message_start = now;
+	}
+	last_received = now;
+	timing = timed && (h.is_start || timing) && len > 1 && h.kind == packet_kind_t::not_finished;
+
+	auto rc = decode_fragment(p, len, crypt);
+	switch (rc) {
+		case decode_result_t::received:
+			stats.rx_received++;
+			if (continued) {
+				count_time(stats.reassembly_time, now - message_start);
+			}
+			break;
+		case decode_result_t::require_more:
+			stats.rx_require_more++;
+			break;
+		case decode_result_t::skipping:
+			stats.rx_skipping++;
+			break;
+		case decode_result_t::dropped:
+			stats.rx_dropped++;
+			break;
+	}
+	return rc;
+}
+
+template <typename Crypt>
 decode_result_t
-SesameBLETransport::decode(const std::byte* p, size_t len, CryptHandler& crypt) {
+SesameBLETransport::decode_fragment(const std::byte* p, size_t len, Crypt& crypt) {
 	if (len <= 1) {
 		return decode_result_t::dropped;
 	}
@@ -50,6 +268,10 @@ SesameBLETransport::decode(const std::byte* p, size_t len, CryptHandler& crypt)
 	if (h.is_start) {
 		buffer.skipping = false;
 		buffer.recv_size = 0;
+		if (h.kind != packet_kind_t::not_finished) {
+			return decode_single(h.kind, p + 1, len - 1, crypt);
+		}
+		crypt.decrypt_begin();
 	}
 	if (buffer.skipping) {
 		if (h.kind == packet_kind_t::encrypted) {
@@ -57,8 +279,9 @@ SesameBLETransport::decode(const std::byte* p, size_t len, CryptHandler& crypt)
 		}
 		return decode_result_t::skipping;
 	}
-	if (buffer.recv_size + len - 1 > SesameBLEBuffer::MAX_RECV) {
-		DEBUG_PRINTLN("Received data too long, skipping");
+	if (buffer.recv_size + len - 1 > buffer.capacity || !prepare_buffer()) {
+		DEBUG_PRINTLN("Received data too long or no buffer available, skipping");
+		stats.rx_oversize++;
 		buffer.skipping = true;
 		if (h.kind == packet_kind_t::encrypted) {
 			crypt.update_dec_iv();
@@ -68,28 +291,72 @@ SesameBLETransport::decode(const std::byte* p, size_t len, CryptHandler& crypt)
 	std::copy(p + 1, p + len, &buffer.recv_buffer[buffer.recv_size]);
 	buffer.recv_size += len - 1;
 	if (h.kind == packet_kind_t::not_finished) {
+		/*
+		 * Kind of the message is unknown until the last fragment, decrypt speculatively while the session key is available.
+		 * The last fragment has at least 1 byte, so the CMAC tag is not in the bytes before the last (CMAC_TAG_SIZE - 1) bytes.
+		 */
+		if (crypt.is_key_shared() && buffer.recv_size > CryptHandler::CMAC_TAG_SIZE - 1) {
+			crypt.decrypt_update(buffer.recv_buffer, buffer.recv_size - (CryptHandler::CMAC_TAG_SIZE - 1));
+		}
 		// wait next packet
 		return decode_result_t::require_more;
 	}
 	buffer.skipping = true;
 	if (h.kind == packet_kind_t::encrypted) {
-		if (buffer.recv_size < CryptHandler::CMAC_TAG_SIZE) {
-			DEBUG_PRINTLN("Encrypted message too short");
-			return decode_result_t::skipping;
-		}
-		if (!crypt.is_key_shared()) {
-			DEBUG_PRINTLN("Encrypted message received before key sharing");
+		if (!is_decryptable(buffer.recv_size, crypt)) {
+			stats.rx_undecryptable++;
 			return decode_result_t::skipping;
 		}
-		std::array<std::byte, SesameBLEBuffer::MAX_RECV - CryptHandler::CMAC_TAG_SIZE> decrypted{};
-		if (!crypt.decrypt(buffer.recv_buffer.data(), buffer.recv_size, &decrypted[0],
-		                   buffer.recv_size - CryptHandler::CMAC_TAG_SIZE)) {
+		if (!crypt.decrypt_finish(buffer.recv_buffer, buffer.recv_size)) {
+			stats.rx_auth_failed++;
 			return decode_result_t::skipping;
 		}
-		std::copy(decrypted.cbegin(), decrypted.cbegin() + buffer.recv_size - CryptHandler::CMAC_TAG_SIZE, &buffer.recv_buffer[0]);
 		buffer.recv_size -= CryptHandler::CMAC_TAG_SIZE;
-	} else if (h.kind != packet_kind_t::plain) {
+	} else if (h.kind == packet_kind_t::plain) {
+		if (crypt.get_decrypted_size() > 0) {
+			crypt.decrypt_abort(buffer.recv_buffer);
+		}
+	} else {
 		DEBUG_PRINTF("%u: Unexpected packet kind\n", static_cast<uint8_t>(h.kind));
+		stats.rx_bad_kind++;
+		return decode_result_t::skipping;
+	}
+	message = buffer.recv_buffer;
+	message_size = buffer.recv_size;
+	return decode_result_t::received;
+}
+
+/*
+ * Whole message in one fragment, reassembly buffer is not used.
+ * Plain message is referred in the caller's buffer, encrypted message is decrypted directly into the receive buffer.
+ */
+template <typename Crypt>
+decode_result_t
+SesameBLETransport::decode_single(packet_kind_t kind, const std::byte* payload, size_t size, Crypt& crypt) {
+	buffer.skipping = true;
+	if (kind == packet_kind_t::encrypted && (size > buffer.capacity || !prepare_buffer())) {
+		DEBUG_PRINTLN("Received data too long or no buffer available, skipping");
+		stats.rx_oversize++;
+		crypt.update_dec_iv();
+		return decode_result_t::skipping;
+	}
+	if (kind == packet_kind_t::encrypted) {
+		if (!is_decryptable(size, crypt)) {
+			stats.rx_undecryptable++;
+			return decode_result_t::skipping;
+		}
+		if (!crypt.decrypt(payload, size, buffer.recv_buffer, size - CryptHandler::CMAC_TAG_SIZE)) {
+			stats.rx_auth_failed++;
+			return decode_result_t::skipping;
+		}
+		message = buffer.recv_buffer;
+		message_size = size - CryptHandler::CMAC_TAG_SIZE;
+	} else if (kind == packet_kind_t::plain) {
+		message = payload;
+		message_size = size;
+	} else {
+		DEBUG_PRINTF("%u: Unexpected packet kind\n", static_cast<uint8_t>(kind));
+		stats.rx_bad_kind++;
 		return decode_result_t::skipping;
 	}
 	return decode_result_t::received;
@@ -98,6 +365,137 @@ SesameBLETransport::decode(const std::byte* p, size_t len, CryptHandler& crypt)
 void
 SesameBLETransport::reset() {
 	buffer.reset();
+	release_buffer();
+	message = buffer.recv_buffer;
+	message_size = 0;
+	fragment_size = DEFAULT_FRAGMENT_SIZE;
+	tx_queue.clear();
+	timing = false;
+}
+
+bool
+SesameBLETransport::prepare_buffer() {
+	if (buffer.recv_buffer) {
+		return true;
+	}
+	buffer.recv_buffer = pool->acquire();
+	return buffer.recv_buffer != nullptr;
+}
+
+/*
+ * Return the borrowed buffer to the pool unless reassembly is in progress.
+ * Received message (data()) is not available after this.
+ */
+void
+SesameBLETransport::release_buffer() {
+	if (!pool || !buffer.recv_buffer || (!buffer.skipping && buffer.recv_size > 0)) {
+		return;
+	}
+	pool->release(buffer.recv_buffer);
+	buffer.recv_buffer = nullptr;
+}
+
+std::byte*
+SesameBLEBufferPool::acquire() {
+	auto fnd = std::find(in_use.begin(), in_use.end(), false);
+	if (fnd == in_use.end()) {
+		return nullptr;
+	}
+	*fnd = true;
+	return &storage[std::distance(in_use.begin(), fnd) * capacity];
+}
+
+void
+SesameBLEBufferPool::release(std::byte* buffer) {
+	in_use[(buffer - storage.data()) / capacity] = false;
+}
+
+size_t
+SesameBLEBufferPool::get_in_use_count() const {
+	return std::count(in_use.cbegin(), in_use.cend(), true);
+}
+
+bool
+SesameBLETxQueue::push(const std::byte* frame, size_t size) {
+	if (ENTRY_HEADER_SIZE + size > available()) {
+		return false;
+	}
+	if (tail + ENTRY_HEADER_SIZE + size > capacity) {
+		std::copy(&storage[head], &storage[tail], storage);
+		tail -= head;
+		head = 0;
+	}
+	storage[tail] = std::byte{static_cast<uint8_t>(size)};
+	storage[tail + 1] = std::byte{static_cast<uint8_t>(size >> 8)};
+	std::copy(frame, frame + size, &storage[tail + ENTRY_HEADER_SIZE]);
+	tail += ENTRY_HEADER_SIZE + size;
+	count++;
+	return true;
+}
+
+size_t
+SesameBLETxQueue::peek(tx_fragment_t* fragments, size_t max_count) const {
+	size_t pos = head;
+	size_t n = 0;
+	for (; n < std::min(count, max_count); n++) {
+		size_t size = std::to_integer<size_t>(storage[pos]) | std::to_integer<size_t>(storage[pos + 1]) << 8;
+		fragments[n] = {to_cptr(&storage[pos + ENTRY_HEADER_SIZE]), size};
+		pos += ENTRY_HEADER_SIZE + size;
+	}
+	return n;
+}
+
+void
+SesameBLETxQueue::pop(size_t n) {
+	for (size_t i = 0; i < n && count > 0; i++, count--) {
+		size_t size = std::to_integer<size_t>(storage[head]) | std::to_integer<size_t>(storage[head + 1]) << 8;
+		head += ENTRY_HEADER_SIZE + size;
+	}
+	if (count == 0) {
+		head = tail = 0;
+	}
+}
+
+void
+SesameBLETxQueue::clear() {
+	head = tail = count = 0;
+}
+
+/*
+ * Fragment payload size follows the negotiated ATT MTU (notification / write payload is MTU - 3, and 1 for our header).
+ * Never goes below the default, peers always accept 20 bytes writes.
+ */
+void
+SesameBLETransport::set_mtu(uint16_t mtu) {
+	if (mtu <= ATT_HEADER_SIZE + 1 + DEFAULT_FRAGMENT_SIZE) {
+		fragment_size = DEFAULT_FRAGMENT_SIZE;
+	} else {
+		fragment_size = std::min<size_t>(mtu, MAX_MTU) - ATT_HEADER_SIZE - 1;
+	}
+}
+
+transport_stats_t&
+transport_stats_t::operator+=(const transport_stats_t& that) {
+	tx_messages += that.tx_messages;
+	tx_fragments += that.tx_fragments;
+	tx_bytes += that.tx_bytes;
+	tx_queued += that.tx_queued;
+	tx_rejected += that.tx_rejected;
+	rx_fragments += that.rx_fragments;
+	rx_bytes += that.rx_bytes;
+	rx_received += that.rx_received;
+	rx_require_more += that.rx_require_more;
+	rx_skipping += that.rx_skipping;
+	rx_dropped += that.rx_dropped;
+	rx_oversize += that.rx_oversize;
+	rx_auth_failed += that.rx_auth_failed;
+	rx_undecryptable += that.rx_undecryptable;
+	rx_bad_kind += that.rx_bad_kind;
+	for (size_t i = 0; i < HISTOGRAM_BINS; i++) {
+		fragment_gap[i] += that.fragment_gap[i];
+		reassembly_time[i] += that.reassembly_time[i];
+	}
+	return *this;
 }
 
 void
@@ -106,29 +504,54 @@ SesameBLETransport::disconnect() {
 	reset();
 }
 
+template <typename Crypt>
 bool
 SesameBLETransport::send_notify(Sesame::op_code_t op_code,
                                 Sesame::item_code_t item_code,
                                 const std::byte* data,
                                 size_t data_size,
                                 bool is_crypted,
-                                CryptHandler& crypt) {
-	const size_t pkt_size = 2 + data_size + (is_crypted ? Sesame::CMAC_TAG_SIZE : 0);  // 2 for op/item, 4 for encrypted tag
-	std::byte pkt[pkt_size];
-	if (is_crypted) {
-		std::byte plain[2 + data_size];
-		plain[0] = to_byte(op_code);
-		plain[1] = to_byte(item_code);
-		std::copy(data, data + data_size, &plain[2]);
-		if (!crypt.encrypt(plain, sizeof(plain), pkt, sizeof(pkt))) {
-			return false;
-		}
-	} else {
-		pkt[0] = to_byte(op_code);
-		pkt[1] = to_byte(item_code);
-		std::copy(data, data + data_size, &pkt[2]);
-	}
-	return send_data(pkt, pkt_size, is_crypted);
+                                Crypt& crypt) {
+	const std::byte head[]{to_byte(op_code), to_byte(item_code)};
+	return send_message(head, sizeof(head), data, data_size, is_crypted, crypt);
 }
 
+using os3_central_t = BasicCryptHandler<OS3IVHandler, crypt_role_t::central>;
+using os3_peripheral_t = BasicCryptHandler<OS3IVHandler, crypt_role_t::peripheral>;
+using os2_central_t = BasicCryptHandler<OS2IVHandler, crypt_role_t::central>;
+using os2_peripheral_t = BasicCryptHandler<OS2IVHandler, crypt_role_t::peripheral>;
+
+template bool SesameBLETransport::send_message(const std::byte*, size_t, const std::byte*, size_t, bool, os3_central_t&);
+template bool SesameBLETransport::send_notify(Sesame::op_code_t,
+                                              Sesame::item_code_t,
+                                              const std::byte*,
+                                              size_t,
+                                              bool,
+                                              os3_central_t&);
+template decode_result_t SesameBLETransport::decode(const std::byte*, size_t, os3_central_t&);
+template bool SesameBLETransport::send_message(const std::byte*, size_t, const std::byte*, size_t, bool, os3_peripheral_t&);
+template bool SesameBLETransport::send_notify(Sesame::op_code_t,
+                                              Sesame::item_code_t,
+                                              const std::byte*,
+                                              size_t,
+                                              bool,
+                                              os3_peripheral_t&);
+template decode_result_t SesameBLETransport::decode(const std::byte*, size_t, os3_peripheral_t&);
+template bool SesameBLETransport::send_message(const std::byte*, size_t, const std::byte*, size_t, bool, os2_central_t&);
+template bool SesameBLETransport::send_notify(Sesame::op_code_t,
+                                              Sesame::item_code_t,
+                                              const std::byte*,
+                                              size_t,
+                                              bool,
+                                              os2_central_t&);
+template decode_result_t SesameBLETransport::decode(const std::byte*, size_t, os2_central_t&);
+template bool SesameBLETransport::send_message(const std::byte*, size_t, const std::byte*, size_t, bool, os2_peripheral_t&);
+template bool SesameBLETransport::send_notify(Sesame::op_code_t,
+                                              Sesame::item_code_t,
+                                              const std::byte*,
+                                              size_t,
+                                              bool,
+                                              os2_peripheral_t&);
+template decode_result_t SesameBLETransport::decode(const std::byte*, size_t, os2_peripheral_t&);
+
 }  // namespace libsesame3bt::core
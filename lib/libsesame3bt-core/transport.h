@@ -1,8 +1,14 @@
 #pragma once
+#include <array>
 #include <cstddef>
+#include <vector>
 #include "crypt.h"
 #include "libsesame3bt/BLEBackend.h"
 
+#ifndef LIBSESAME3BTCORE_SEND_SIZE
+#define LIBSESAME3BTCORE_SEND_SIZE 256
+#endif
+
 namespace libsesame3bt::core {
 
 enum packet_kind_t { not_finished = 0, plain = 1, encrypted = 2 };  // do not use enum class to avoid warning in structure below.
@@ -19,42 +25,169 @@ class SesameBLEBuffer {
 	friend class SesameBLETransport;
 
  public:
-	static constexpr size_t MAX_RECV = 256;
-
-	SesameBLEBuffer() { reset(); }
+	SesameBLEBuffer(std::byte* storage, size_t capacity) : recv_buffer(storage), capacity(capacity) { reset(); }
 	void reset() {
 		recv_size = 0;
 		skipping = false;
 	}
+	size_t get_capacity() const { return capacity; }
 
  private:
-	std::array<std::byte, MAX_RECV> recv_buffer{};
+	std::byte* recv_buffer;
+	const size_t capacity;
 	size_t recv_size;
 	bool skipping;
 };
 
+/**
+ * @brief Receive buffers shared by transports
+ * A transport borrows a buffer only while a message requires it (reassembly or decryption).
+ */
+class SesameBLEBufferPool {
+ public:
+	SesameBLEBufferPool(size_t count, size_t capacity) : storage(count * capacity), in_use(count), capacity(capacity) {}
+	SesameBLEBufferPool(const SesameBLEBufferPool&) = delete;
+	SesameBLEBufferPool& operator=(const SesameBLEBufferPool&) = delete;
+	std::byte* acquire();
+	void release(std::byte* buffer);
+	size_t get_capacity() const { return capacity; }
+	size_t get_count() const { return in_use.size(); }
+	size_t get_in_use_count() const;
+
+ private:
+	std::vector<std::byte> storage;
+	std::vector<bool> in_use;
+	const size_t capacity;
+};
+
+/**
+ * @brief Outgoing fragments not yet accepted by the backend
+ * Each fragment is stored contiguously (2 bytes size + frame), so queued fragments can be passed to the backend as is.
+ */
+class SesameBLETxQueue {
+ public:
+	static constexpr size_t ENTRY_HEADER_SIZE = 2;
+	explicit SesameBLETxQueue(size_t capacity) : owned(capacity), storage(owned.data()), capacity(capacity) {}
+	/// @param storage capacity bytes owned by the caller (kept across connections)
+	SesameBLETxQueue(std::byte* storage, size_t capacity) : storage(storage), capacity(capacity) {}
+	SesameBLETxQueue(const SesameBLETxQueue&) = delete;
+	SesameBLETxQueue& operator=(const SesameBLETxQueue&) = delete;
+	bool push(const std::byte* frame, size_t size);
+	size_t peek(tx_fragment_t* fragments, size_t max_count) const;
+	void pop(size_t count);
+	void clear();
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+	size_t get_capacity() const { return capacity; }
+	size_t available() const { return capacity - (tail - head); }
+
+ private:
+	std::vector<std::byte> owned;
+	std::byte* const storage;
+	const size_t capacity;
+	size_t head = 0;
+	size_t tail = 0;
+	size_t count = 0;
+};
+
 class SesameBLETransport {
  public:
 	enum class decode_result_t { skipping, received, require_more, dropped };
-	SesameBLETransport(SesameBLEBackend& backend) : backend(backend) {}
+	static constexpr size_t DEFAULT_FRAGMENT_SIZE = 19;  // default ATT MTU(23) - ATT header(3) - packet header(1)
+	static constexpr size_t MAX_MTU = 517;
+	static constexpr size_t DEFAULT_TX_QUEUE_SIZE = 0;  // no queue
+	static constexpr size_t MAX_SEND = LIBSESAME3BTCORE_SEND_SIZE;  // including CMAC tag
+	SesameBLETransport(SesameBLEBackend& backend,
+	                   std::byte* recv_storage,
+	                   size_t recv_capacity,
+	                   size_t tx_queue_size = DEFAULT_TX_QUEUE_SIZE)
+	    : backend(backend), buffer(recv_storage, recv_capacity), tx_queue(tx_queue_size) {}
+	template <size_t N>
+	SesameBLETransport(SesameBLEBackend& backend, std::array<std::byte, N>& recv_storage, size_t tx_queue_size = DEFAULT_TX_QUEUE_SIZE)
+	    : SesameBLETransport(backend, recv_storage.data(), N, tx_queue_size) {}
+	SesameBLETransport(SesameBLEBackend& backend, SesameBLEBufferPool& pool, size_t tx_queue_size = DEFAULT_TX_QUEUE_SIZE)
+	    : backend(backend), buffer(nullptr, pool.get_capacity()), pool(&pool), tx_queue(tx_queue_size) {}
+	SesameBLETransport(SesameBLEBackend& backend, SesameBLEBufferPool& pool, std::byte* tx_storage, size_t tx_queue_size)
+	    : backend(backend), buffer(nullptr, pool.get_capacity()), pool(&pool), tx_queue(tx_storage, tx_queue_size) {}
+	~SesameBLETransport() { reset(); }  // also returns a buffer in the middle of reassembly
 	SesameBLETransport(const SesameBLETransport&) = delete;
 	SesameBLETransport& operator=(const SesameBLETransport&) = delete;
-	bool send_data(const std::byte* pkt, size_t pkt_size, bool is_crypted);
+	template <typename Crypt>
+	bool send_message(const std::byte* head,
+	                  size_t head_size,
+	                  const std::byte* data,
+	                  size_t data_size,
+	                  bool is_crypted,
+	                  Crypt& crypt);
+	bool send_message(const std::byte* head,
+	                  size_t head_size,
+	                  const std::byte* data,
+	                  size_t data_size,
+	                  bool is_crypted,
+	                  CryptHandler& crypt) {
+		return crypt.visit([&](auto& c) { return send_message(head, head_size, data, data_size, is_crypted, c); });
+	}
+	bool can_send(size_t pkt_size) const;
+	bool prepare_send(size_t pkt_size);
+	bool flush();
+	size_t get_queue_depth() const { return tx_queue.size(); }
+	template <typename Crypt>
+	bool send_notify(Sesame::op_code_t op_code,
+	                 Sesame::item_code_t item_code,
+	                 const std::byte* data,
+	                 size_t data_size,
+	                 bool is_crypted,
+	                 Crypt& crypt);
 	bool send_notify(Sesame::op_code_t op_code,
 	                 Sesame::item_code_t item_code,
 	                 const std::byte* data,
 	                 size_t data_size,
 	                 bool is_crypted,
-	                 CryptHandler& crypt);
-	decode_result_t decode(const std::byte* data, size_t size, CryptHandler& crypt);
+	                 CryptHandler& crypt) {
+		return crypt.visit([&](auto& c) { return send_notify(op_code, item_code, data, data_size, is_crypted, c); });
+	}
+	template <typename Crypt>
+	decode_result_t decode(const std::byte* data, size_t size, Crypt& crypt);
+	/// @note CryptHandler dispatches once per fragment, the rest runs on the concrete handler
+	decode_result_t decode(const std::byte* data, size_t size, CryptHandler& crypt) {
+		return crypt.visit([&](auto& c) { return decode(data, size, c); });
+	}
 	void disconnect();
 	void reset();
-	const std::byte* data() { return buffer.recv_buffer.data(); }
-	size_t data_size() { return buffer.recv_size; }
+	void set_mtu(uint16_t mtu);
+	size_t get_fragment_size() const { return fragment_size; }
+	/// @note Valid until next decode() or release_buffer(). May refer to the data passed to decode() (single fragment plain message).
+	const std::byte* data() { return message; }
+	size_t data_size() { return message_size; }
+	void release_buffer();
+	const transport_stats_t& get_stats() const { return stats; }
+	bool get_time_ms(uint32_t& now) { return backend.get_time_ms(now); }
+	void reset_stats() { stats = {}; }
 
  private:
 	SesameBLEBackend& backend;
 	SesameBLEBuffer buffer;
+	SesameBLEBufferPool* pool = nullptr;
+	const std::byte* message = buffer.recv_buffer;
+	size_t message_size = 0;
+	size_t fragment_size = DEFAULT_FRAGMENT_SIZE;
+	SesameBLETxQueue tx_queue;
+	transport_stats_t stats{};
+	uint32_t message_start = 0;  // millis
+	uint32_t last_received = 0;  // millis
+	bool timing = false;         // start fragment of the message being received was timed
+
+	size_t count_fragments(size_t pkt_size) const { return (pkt_size + fragment_size - 1) / fragment_size; }
+	bool prepare_buffer();
+	size_t frame_size(size_t pkt_size, size_t index) const { return std::min(pkt_size - index * fragment_size, fragment_size) + 1; }
+	bool lease_frames(std::byte** frames, size_t nfragments, size_t pkt_size);
+	bool commit_frames(std::byte* const* frames, size_t nfragments, size_t pkt_size);
+	bool transmit(std::byte* const* frames, size_t nfragments, size_t pkt_size);
+	void count_sent(size_t nfragments, size_t pkt_size, size_t queued);
+	template <typename Crypt>
+	decode_result_t decode_fragment(const std::byte* data, size_t size, Crypt& crypt);
+	template <typename Crypt>
+	decode_result_t decode_single(packet_kind_t kind, const std::byte* payload, size_t size, Crypt& crypt);
 };
 
 }  // namespace libsesame3bt::core
@@ -23,7 +23,8 @@ class StubBackend : public SesameBLEBackend {
 };
 
 StubBackend backend;
-SesameBLETransport transport{backend};
+std::array<std::byte, 256> recv_storage;
+SesameBLETransport transport{backend, recv_storage};
 CryptHandler cr_c{std::in_place_type<OS3IVHandler>};
 CryptHandler cr_p{std::in_place_type<OS3IVHandler>, true};
 
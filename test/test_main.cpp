@@ -1,5 +1,17 @@
 #include <Arduino.h>
+#include <mbedtls/ccm.h>
+#include <mbedtls/platform.h>
 #include <unity.h>
+#include <cstdlib>
+#include <new>
+#include "crypt.h"
+#include "crypt_ccm.h"
+#include "crypt_ecc.h"
+#include "crypt_random.h"
+#include "libsesame3bt/ClientCore.h"
+#include "libsesame3bt/ServerCore.h"
+#include "os3_iv.h"
+#include "transport.h"
 #include "SesameClient.h"
 #include "util.h"
 #if __has_include("mysesame-config.h")
@@ -106,6 +118,761 @@ test_vol_pct() {
 	TEST_ASSERT_MESSAGE(lower > 50.0f, "lower > 50%");
 }
 
+// the array is filled in place (OS2 login token was left zero)
+void
+test_random_array() {
+	std::array<std::byte, 32> buf{};
+	TEST_ASSERT_TRUE(libsesame3bt::core::Random::get_random(buf));
+	TEST_ASSERT_FALSE(std::all_of(buf.cbegin(), buf.cend(), [](std::byte b) { return b == std::byte{0}; }));
+}
+
+void
+test_ccm_kat() {
+	using libsesame3bt::core::Aes128;
+	using libsesame3bt::core::SesameCcm;
+	std::array<std::byte, 16> key;
+	SesameCcm::nonce_t nonce;
+	for (size_t i = 0; i < key.size(); i++) {
+		key[i] = std::byte(i * 11 + 3);
+	}
+	for (size_t i = 0; i < nonce.size(); i++) {
+		nonce[i] = std::byte(0xf0 - i);
+	}
+	Aes128 aes;
+	TEST_ASSERT_TRUE(aes.set_key(key.data(), key.size()));
+	mbedtls_ccm_context ctx;
+	mbedtls_ccm_init(&ctx);
+	TEST_ASSERT_EQUAL(0, mbedtls_ccm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, reinterpret_cast<const unsigned char*>(key.data()), 128));
+	const unsigned char add[1]{};
+	for (size_t size = 0; size < 256; size++) {
+		std::byte plain[256];
+		std::byte data[256];
+		unsigned char expected[256 + SesameCcm::TAG_SIZE];
+		for (size_t i = 0; i < size; i++) {
+			plain[i] = data[i] = std::byte(i * 7 + size);
+		}
+		TEST_ASSERT_EQUAL(0, mbedtls_ccm_encrypt_and_tag(&ctx, size, reinterpret_cast<const unsigned char*>(nonce.data()), nonce.size(), add,
+		                                                 sizeof(add), reinterpret_cast<const unsigned char*>(plain), expected,
+		                                                 &expected[size], SesameCcm::TAG_SIZE));
+		SesameCcm::tag_t tag;
+		TEST_ASSERT_TRUE(SesameCcm::encrypt(aes, SesameCcm::Nonce{nonce}, &data[0], size, tag));
+		if (size > 0) {
+			TEST_ASSERT_EQUAL_MEMORY(expected, data, size);
+		}
+		TEST_ASSERT_EQUAL_MEMORY(&expected[size], tag.data(), tag.size());
+		TEST_ASSERT_TRUE(SesameCcm::compute_tag(aes, SesameCcm::Nonce{nonce}, &plain[0], size, tag));
+		TEST_ASSERT_EQUAL_MEMORY(&expected[size], tag.data(), tag.size());
+	}
+	mbedtls_ccm_free(&ctx);
+}
+
+// receive window of BasicCryptHandler::authenticate() (messages lost between sender and receiver)
+void
+test_iv_resync() {
+	using namespace libsesame3bt::core;
+	BasicCryptHandler<OS3IVHandler, crypt_role_t::peripheral> sender;
+	BasicCryptHandler<OS3IVHandler, crypt_role_t::central> receiver;
+	keystream_pair_t keystreams;
+	std::array<std::byte, 16> key;
+	for (size_t i = 0; i < key.size(); i++) {
+		key[i] = std::byte(i * 5 + 9);
+	}
+	const std::array<std::byte, Sesame::TOKEN_SIZE> local_nonce{};
+	const std::byte remote_nonce[Sesame::TOKEN_SIZE]{std::byte{1}, std::byte{2}, std::byte{3}, std::byte{4}};
+	TEST_ASSERT_TRUE(sender.set_session_key(key.data(), key.size(), local_nonce, remote_nonce));
+	TEST_ASSERT_TRUE(receiver.set_session_key(key.data(), key.size(), local_nonce, remote_nonce));
+	receiver.set_keystream_storage(&keystreams);
+
+	constexpr size_t SIZE = 40;
+	constexpr size_t COUNT = 15;
+	std::byte messages[COUNT][SIZE + CryptHandler::CMAC_TAG_SIZE];  // consecutive IVs
+	for (size_t i = 0; i < COUNT; i++) {
+		std::byte plain[SIZE];
+		for (size_t j = 0; j < SIZE; j++) {
+			plain[j] = std::byte(i * 31 + j);
+		}
+		TEST_ASSERT_TRUE(sender.encrypt(plain, sizeof(plain), messages[i], sizeof(messages[i])));
+	}
+	auto receive = [&](const std::byte(&message)[SIZE + CryptHandler::CMAC_TAG_SIZE], size_t index) {
+		std::byte out[SIZE];
+		if (!receiver.precompute_keystream() || !receiver.decrypt(message, sizeof(message), out, sizeof(out))) {
+			return false;
+		}
+		for (size_t j = 0; j < SIZE; j++) {
+			if (out[j] != std::byte(index * 31 + j)) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// window 0: a skipped IV is rejected, the receive IV stays
+	TEST_ASSERT_TRUE(receive(messages[0], 0));
+	TEST_ASSERT_FALSE(receive(messages[2], 2));
+	TEST_ASSERT_TRUE(receive(messages[1], 1));
+
+	// window 3: after 2 lost messages, the counter follows the accepted message
+	receiver.set_resync_window(3);
+	TEST_ASSERT_TRUE(receive(messages[4], 4));
+	receiver.set_resync_window(0);
+	TEST_ASSERT_TRUE(receive(messages[5], 5));
+
+	// forged tag inside the window: receive IV and precomputed key stream are left as they were
+	receiver.set_resync_window(3);
+	std::byte forged[SIZE + CryptHandler::CMAC_TAG_SIZE];
+	std::copy(std::cbegin(messages[7]), std::cend(messages[7]), forged);
+	forged[SIZE] ^= std::byte{1};
+	TEST_ASSERT_TRUE(receiver.precompute_keystream());
+	const keystream_pair_t saved = keystreams;
+	TEST_ASSERT_FALSE(receive(forged, 7));
+	TEST_ASSERT_EQUAL_MEMORY(&saved, &keystreams, sizeof(saved));
+	receiver.set_resync_window(0);
+	TEST_ASSERT_TRUE(receive(messages[6], 6));
+
+	// past the window (4 lost) is rejected, up to the window (3 lost) is accepted
+	receiver.set_resync_window(3);
+	TEST_ASSERT_FALSE(receive(messages[11], 11));
+	TEST_ASSERT_TRUE(receive(messages[10], 10));
+	receiver.set_resync_window(0);
+	TEST_ASSERT_TRUE(receive(messages[11], 11));
+	TEST_ASSERT_EQUAL(2, receiver.get_resync_count());
+	receiver.set_keystream_storage(nullptr);
+}
+
+// RFC 4493 4. Test Vectors (AES-128)
+void
+test_cmac_kat() {
+	using libsesame3bt::core::CmacAes128;
+	using libsesame3bt::core::util::hex2bin;
+	std::array<std::byte, 16> key;
+	std::array<std::byte, 64> msg;
+	TEST_ASSERT_TRUE(hex2bin("2b7e151628aed2a6abf7158809cf4f3c", key));
+	TEST_ASSERT_TRUE(hex2bin("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+	                         "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710",
+	                         msg));
+	const std::pair<size_t, const char*> vectors[]{
+	    {0, "bb1d6929e95937287fa37d129b756746"},
+	    {16, "070a16b46b4d4144f79bdd9dd04a287c"},
+	    {40, "dfa66747de9ae63030ca32611497c827"},
+	    {64, "51f0bebf7e3b9d92fc49741779363cfe"},
+	};
+	CmacAes128 cmac;
+	std::array<std::byte, 16> expected, tag;
+	for (const auto& [size, hex] : vectors) {
+		TEST_ASSERT_TRUE(hex2bin(hex, expected));
+		// two updates split at every position, the last complete block must be held back until finish()
+		for (size_t split = 0; split <= size; split++) {
+			TEST_ASSERT_TRUE(cmac.set_key(key));
+			TEST_ASSERT_TRUE(cmac.update(msg.data(), split));
+			TEST_ASSERT_TRUE(cmac.update(msg.data() + split, size - split));
+			TEST_ASSERT_TRUE(cmac.finish(tag));
+			TEST_ASSERT_EQUAL_MEMORY(expected.data(), tag.data(), tag.size());
+		}
+		TEST_ASSERT_TRUE(cmac.set_key(key));
+		for (size_t i = 0; i < size; i++) {
+			TEST_ASSERT_TRUE(cmac.update(&msg[i], 1));
+		}
+		TEST_ASSERT_TRUE(cmac.finish(tag));
+		TEST_ASSERT_EQUAL_MEMORY(expected.data(), tag.data(), tag.size());
+	}
+}
+
+namespace {
+
+struct clocked_backend_t : libsesame3bt::core::SesameBLEBackend {
+	uint32_t now = 0;
+	bool write_to_tx(const uint8_t*, size_t) override { return true; }
+	bool get_time_ms(uint32_t& time) override {
+		time = now;
+		return true;
+	}
+	void disconnect() override {}
+};
+
+}  // namespace
+
+// fragment timing is counted only within a message whose start fragment was received
+void
+test_transport_timing() {
+	using libsesame3bt::core::CryptHandler;
+	using libsesame3bt::core::OS3IVHandler;
+	using libsesame3bt::core::SesameBLETransport;
+	using decode_result_t = SesameBLETransport::decode_result_t;
+	clocked_backend_t backend;
+	std::array<std::byte, 64> storage;
+	SesameBLETransport transport{backend, storage};
+	CryptHandler crypt{std::in_place_type<OS3IVHandler>};
+	const std::byte start[]{std::byte{0x01}, std::byte{'a'}};   // start, not finished
+	const std::byte middle[]{std::byte{0x00}, std::byte{'b'}};  // not finished
+	const std::byte last[]{std::byte{0x02}, std::byte{'c'}};    // plain
+
+	backend.now = 5000;
+	TEST_ASSERT_TRUE(transport.decode(middle, sizeof(middle), crypt) == decode_result_t::require_more);
+	TEST_ASSERT_TRUE(transport.decode(start, sizeof(start), crypt) == decode_result_t::require_more);
+	backend.now = 5003;
+	TEST_ASSERT_TRUE(transport.decode(middle, sizeof(middle), crypt) == decode_result_t::require_more);
+	backend.now = 5010;
+	TEST_ASSERT_TRUE(transport.decode(last, sizeof(last), crypt) == decode_result_t::received);
+	TEST_ASSERT_EQUAL(3, transport.data_size());
+	// the next message lost its start fragment
+	backend.now = 9000;
+	TEST_ASSERT_TRUE(transport.decode(last, sizeof(last), crypt) == decode_result_t::skipping);
+	transport.reset();
+	TEST_ASSERT_TRUE(transport.decode(start, sizeof(start), crypt) == decode_result_t::require_more);
+	transport.reset();
+	backend.now = 9100;
+	TEST_ASSERT_TRUE(transport.decode(last, sizeof(last), crypt) == decode_result_t::received);
+
+	const auto& stats = transport.get_stats();
+	TEST_ASSERT_EQUAL(7, stats.rx_fragments);
+	const uint32_t gap[libsesame3bt::core::transport_stats_t::HISTOGRAM_BINS]{0, 0, 1, 1};  // 3 ms, 7 ms
+	const uint32_t reassembly[libsesame3bt::core::transport_stats_t::HISTOGRAM_BINS]{0, 0, 0, 0, 1};  // 10 ms
+	TEST_ASSERT_EQUAL_MEMORY(gap, stats.fragment_gap, sizeof(gap));
+	TEST_ASSERT_EQUAL_MEMORY(reassembly, stats.reassembly_time, sizeof(reassembly));
+}
+
+namespace {
+
+size_t allocations = 0;
+bool count_allocations = false;
+
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+void*
+counting_calloc(size_t n, size_t size) {
+	if (count_allocations) {
+		allocations++;
+	}
+	return calloc(n, size);
+}
+#endif
+
+// BLE link between client and server cores (fragments are copied to fixed slots, no heap)
+struct loopback_queue_t {
+	static constexpr size_t SLOTS = 16;
+	uint8_t frames[SLOTS][256];
+	size_t sizes[SLOTS];
+	size_t head = 0;
+	size_t tail = 0;
+
+	bool push(const uint8_t* data, size_t size) {
+		if (tail - head >= SLOTS || size > sizeof(frames[0])) {
+			return false;
+		}
+		std::copy(data, data + size, frames[tail % SLOTS]);
+		sizes[tail++ % SLOTS] = size;
+		return true;
+	}
+	bool empty() const { return head == tail; }
+};
+
+loopback_queue_t to_server;
+loopback_queue_t to_client;
+
+struct loopback_client_backend_t : libsesame3bt::core::SesameBLEBackend {
+	uint32_t now = 0;
+	bool has_clock = true;
+	bool write_to_tx(const uint8_t* data, size_t size) override { return to_server.push(data, size); }
+	bool get_time_ms(uint32_t& time) override {
+		time = now;
+		return has_clock;
+	}
+	void disconnect() override {}
+};
+
+struct loopback_server_backend_t : libsesame3bt::core::ServerBLEBackend {
+	bool write_to_central(uint16_t, const uint8_t* data, size_t size) override { return to_client.push(data, size); }
+	void disconnect(uint16_t) override {}
+};
+
+}  // namespace
+
+void*
+operator new(size_t size) {
+	if (count_allocations) {
+		allocations++;
+	}
+	void* p = malloc(size > 0 ? size : 1);
+	if (!p) {
+		abort();
+	}
+	return p;
+}
+
+void
+operator delete(void* p) noexcept {
+	free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+namespace {
+
+// accepts credit writes, then rejects (BLE stack busy)
+struct busy_backend_t : libsesame3bt::core::SesameBLEBackend {
+	loopback_queue_t& link;
+	size_t credit = 0;
+	explicit busy_backend_t(loopback_queue_t& link) : link(link) {}
+	bool write_to_tx(const uint8_t* data, size_t size) override {
+		if (credit == 0) {
+			return false;
+		}
+		credit--;
+		return link.push(data, size);
+	}
+	void disconnect() override {}
+};
+
+}  // namespace
+
+void
+test_tx_queue() {
+	using libsesame3bt::core::CryptHandler;
+	using libsesame3bt::core::OS3IVHandler;
+	using libsesame3bt::core::SesameBLETransport;
+	loopback_queue_t link;
+	busy_backend_t backend{link};
+	loopback_client_backend_t dummy;
+	std::array<std::byte, 64> sender_storage;
+	std::array<std::byte, 64> receiver_storage;
+	SesameBLETransport sender{backend, sender_storage, 128};
+	SesameBLETransport receiver{dummy, receiver_storage};
+	CryptHandler crypt{std::in_place_type<OS3IVHandler>};
+	std::byte data[3][50];  // 52 bytes with op code and item code, 3 fragments
+	for (size_t i = 0; i < std::size(data); i++) {
+		std::fill(std::begin(data[i]), std::end(data[i]), std::byte(i + 1));
+	}
+	auto send = [&](size_t i) {
+		return sender.send_notify(Sesame::op_code_t::publish, Sesame::item_code_t::mech_status, data[i], sizeof(data[i]), false, crypt);
+	};
+
+	backend.credit = 1;
+	TEST_ASSERT_TRUE(send(0));
+	TEST_ASSERT_EQUAL(2, sender.get_queue_depth());
+	TEST_ASSERT_TRUE(send(1));  // behind the queued fragments
+	TEST_ASSERT_EQUAL(5, sender.get_queue_depth());
+	// whole message or nothing
+	TEST_ASSERT_FALSE(send(2));
+	TEST_ASSERT_EQUAL(5, sender.get_queue_depth());
+	TEST_ASSERT_EQUAL(1, link.tail);
+
+	// backend accepts writes again (SesameClientCore::on_tx_ready() flushes)
+	backend.credit = 2;
+	TEST_ASSERT_FALSE(sender.flush());
+	TEST_ASSERT_EQUAL(3, sender.get_queue_depth());
+	backend.credit = 100;
+	TEST_ASSERT_TRUE(sender.flush());
+	TEST_ASSERT_EQUAL(0, sender.get_queue_depth());
+	TEST_ASSERT_TRUE(send(2));
+
+	size_t received = 0;
+	for (; !link.empty(); link.head++) {
+		auto i = link.head % loopback_queue_t::SLOTS;
+		if (receiver.decode(reinterpret_cast<const std::byte*>(link.frames[i]), link.sizes[i], crypt) ==
+		    SesameBLETransport::decode_result_t::received) {
+			TEST_ASSERT_EQUAL(2 + sizeof(data[received]), receiver.data_size());
+			TEST_ASSERT_EQUAL_MEMORY(data[received], receiver.data() + 2, sizeof(data[received]));
+			received++;
+		}
+	}
+	TEST_ASSERT_EQUAL(3, received);
+	const auto& stats = sender.get_stats();
+	TEST_ASSERT_EQUAL(3, stats.tx_messages);
+	TEST_ASSERT_EQUAL(5, stats.tx_queued);
+	TEST_ASSERT_EQUAL(1, stats.tx_rejected);
+}
+
+// receive buffers shared by more transports than buffers
+void
+test_buffer_pool() {
+	using libsesame3bt::core::CryptHandler;
+	using libsesame3bt::core::OS3IVHandler;
+	using libsesame3bt::core::SesameBLEBufferPool;
+	using libsesame3bt::core::SesameBLETransport;
+	using decode_result_t = SesameBLETransport::decode_result_t;
+	loopback_client_backend_t backend;
+	SesameBLEBufferPool pool{1, 64};
+	SesameBLETransport a{backend, pool};
+	SesameBLETransport b{backend, pool};
+	CryptHandler crypt{std::in_place_type<OS3IVHandler>};
+	const std::byte start[]{std::byte{0x01}, std::byte{'a'}};  // start, not finished
+	const std::byte last[]{std::byte{0x02}, std::byte{'b'}};   // plain
+
+	TEST_ASSERT_TRUE(a.decode(start, sizeof(start), crypt) == decode_result_t::require_more);
+	TEST_ASSERT_EQUAL(1, pool.get_in_use_count());
+	// exhausted, the message is skipped
+	TEST_ASSERT_TRUE(b.decode(start, sizeof(start), crypt) == decode_result_t::skipping);
+	TEST_ASSERT_TRUE(b.decode(last, sizeof(last), crypt) == decode_result_t::skipping);
+	TEST_ASSERT_EQUAL(1, b.get_stats().rx_oversize);
+	TEST_ASSERT_TRUE(a.decode(last, sizeof(last), crypt) == decode_result_t::received);
+	TEST_ASSERT_EQUAL(2, a.data_size());
+	a.release_buffer();
+	TEST_ASSERT_EQUAL(0, pool.get_in_use_count());
+	TEST_ASSERT_TRUE(b.decode(start, sizeof(start), crypt) == decode_result_t::require_more);
+	TEST_ASSERT_TRUE(b.decode(last, sizeof(last), crypt) == decode_result_t::received);
+	b.release_buffer();
+
+	// disconnected in the middle of a message
+	TEST_ASSERT_TRUE(a.decode(start, sizeof(start), crypt) == decode_result_t::require_more);
+	a.reset();
+	TEST_ASSERT_EQUAL(0, pool.get_in_use_count());
+	{
+		SesameBLETransport c{backend, pool};
+		TEST_ASSERT_TRUE(c.decode(start, sizeof(start), crypt) == decode_result_t::require_more);
+	}
+	TEST_ASSERT_EQUAL(0, pool.get_in_use_count());
+}
+
+void
+test_os3_login_without_heap() {
+	using libsesame3bt::core::SesameClientCore;
+	using libsesame3bt::core::SesameServerCore;
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+	mbedtls_platform_set_calloc_free(counting_calloc, free);
+#endif
+	loopback_client_backend_t client_backend;
+	loopback_server_backend_t server_backend;
+	SesameClientCore client{client_backend};
+	SesameServerCore server{server_backend, 1, 1};
+	const uint8_t uuid[16]{0x12, 0x34};
+	std::array<std::byte, Sesame::SECRET_SIZE> secret;
+	for (size_t i = 0; i < secret.size(); i++) {
+		secret[i] = std::byte(i * 13 + 5);
+	}
+	TEST_ASSERT_TRUE(server.begin(Sesame::model_t::sesame_5, uuid));
+	TEST_ASSERT_TRUE(server.set_registered(secret));
+	TEST_ASSERT_TRUE(client.begin(Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", libsesame3bt::core::util::bin2hex(secret)));
+
+	auto login = [&] {
+		server.on_subscribed(1);
+		while (!to_server.empty() || !to_client.empty()) {
+			for (; !to_server.empty(); to_server.head++) {
+				auto i = to_server.head % loopback_queue_t::SLOTS;
+				server.on_received(1, reinterpret_cast<const std::byte*>(to_server.frames[i]), to_server.sizes[i]);
+			}
+			for (; !to_client.empty(); to_client.head++) {
+				auto i = to_client.head % loopback_queue_t::SLOTS;
+				client.on_received(reinterpret_cast<const std::byte*>(to_client.frames[i]), to_client.sizes[i]);
+			}
+		}
+		bool active = client.is_session_active();
+		client.on_disconnected();
+		server.on_disconnected(1);
+		return active;
+	};
+	// first login may initialize the platform lazily (time zone, stdio)
+	TEST_ASSERT_TRUE(login());
+	allocations = 0;
+	count_allocations = true;
+	bool active = true;
+	for (int i = 0; i < 3; i++) {
+		active = login() && active;
+	}
+	count_allocations = false;
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+	mbedtls_platform_set_calloc_free(calloc, free);
+#endif
+	TEST_ASSERT_TRUE(active);
+	TEST_ASSERT_EQUAL(0, allocations);
+}
+
+// SesameServerCore with more sessions than receive buffers
+void
+test_server_recv_buffers() {
+	using libsesame3bt::core::SesameClientCore;
+	using libsesame3bt::core::SesameServerCore;
+	loopback_client_backend_t client_backend;
+	loopback_server_backend_t server_backend;
+	SesameClientCore client{client_backend};
+	SesameServerCore server{server_backend, 2, 1};
+	const uint8_t uuid[16]{0x56, 0x78};
+	std::array<std::byte, Sesame::SECRET_SIZE> secret;
+	for (size_t i = 0; i < secret.size(); i++) {
+		secret[i] = std::byte(i * 11 + 2);
+	}
+	TEST_ASSERT_TRUE(server.begin(Sesame::model_t::sesame_5, uuid));
+	TEST_ASSERT_TRUE(server.set_registered(secret));
+	TEST_ASSERT_TRUE(client.begin(Sesame::model_t::sesame_5));
+	TEST_ASSERT_TRUE(client.set_keys("", libsesame3bt::core::util::bin2hex(secret)));
+
+	size_t commands = 0;
+	server.set_on_command_callback([&](auto&&...) {
+		commands++;
+		return Sesame::result_code_t::success;
+	});
+	auto pump = [&](uint16_t session_id) {
+		while (!to_server.empty() || !to_client.empty()) {
+			for (; !to_server.empty(); to_server.head++) {
+				auto i = to_server.head % loopback_queue_t::SLOTS;
+				server.on_received(session_id, reinterpret_cast<const std::byte*>(to_server.frames[i]), to_server.sizes[i]);
+			}
+			for (; !to_client.empty(); to_client.head++) {
+				auto i = to_client.head % loopback_queue_t::SLOTS;
+				client.on_received(reinterpret_cast<const std::byte*>(to_client.frames[i]), to_client.sizes[i]);
+			}
+		}
+	};
+	// login and an encrypted command (needs a receive buffer), the server session stays connected
+	auto command = [&](uint16_t session_id) {
+		server.on_subscribed(session_id);
+		pump(session_id);
+		size_t before = commands;
+		bool rc = client.is_session_active() && client.lock("test");
+		pump(session_id);
+		client.on_disconnected();
+		return rc && commands == before + 1;
+	};
+	// session 2 holds the only buffer in the middle of a message
+	const std::byte start[]{std::byte{0x01}, std::byte{0}};
+	TEST_ASSERT_TRUE(server.on_subscribed(2));
+	to_client.head = to_client.tail;
+	server.on_received(2, start, sizeof(start));
+	TEST_ASSERT_FALSE(command(1));
+	server.on_disconnected(1);
+	// the buffer comes back when session 2 disconnects
+	server.on_disconnected(2);
+	for (int i = 0; i < 3; i++) {
+		TEST_ASSERT_TRUE(command(1));
+		TEST_ASSERT_TRUE(command(2));
+		TEST_ASSERT_EQUAL(2, server.get_session_count());
+		server.on_disconnected(1);
+		server.on_disconnected(2);
+	}
+}
+
+namespace {
+
+struct loopback_peer_backend_t : libsesame3bt::core::SesameBLEBackend {
+	bool write_to_tx(const uint8_t* data, size_t size) override { return to_client.push(data, size); }
+	void disconnect() override {}
+};
+
+/*
+ * SESAME 3 / 4 side of an OS2 login. The login request is checked and the session key is derived here independently,
+ * the client becomes active only if both sides got the same ECDH result and session key.
+ */
+struct os2_peer_t {
+	libsesame3bt::core::Ecc ecc;
+	std::array<std::byte, libsesame3bt::core::Ecc::PK_SIZE> pk;
+	std::array<std::byte, Sesame::SECRET_SIZE> secret;
+	std::array<std::byte, libsesame3bt::core::Ecc::PK_SIZE> login_pk;  // client public key of the last login
+	size_t updates = 0;                                                  // update() calls until the login request
+
+	bool begin() {
+		for (size_t i = 0; i < secret.size(); i++) {
+			secret[i] = std::byte(i * 7 + 1);
+		}
+		return ecc.generate_keypair() && ecc.export_pk(pk);
+	}
+
+	bool login(libsesame3bt::core::SesameClientCore& client) {
+		using namespace libsesame3bt::core;
+		loopback_peer_backend_t backend;
+		std::array<std::byte, 256> storage;
+		SesameBLETransport transport{backend, storage};
+		CryptHandler crypt{std::in_place_type<OS2IVHandler>, true};
+		std::byte tok[Sesame::TOKEN_SIZE];
+		if (!Random::get_random(tok) ||
+		    !transport.send_notify(Sesame::op_code_t::publish, Sesame::item_code_t::initial, tok, sizeof(tok), false, crypt)) {
+			return false;
+		}
+		deliver(client);
+		for (updates = 0; to_server.empty() && updates < 10000; updates++) {
+			client.update();
+		}
+		auto rc = SesameBLETransport::decode_result_t::dropped;
+		for (; !to_server.empty(); to_server.head++) {
+			auto i = to_server.head % loopback_queue_t::SLOTS;
+			rc = transport.decode(reinterpret_cast<const std::byte*>(to_server.frames[i]), to_server.sizes[i], crypt);
+		}
+		// op code, item code, sesame_ki(2), public key, local token, tag(4)
+		constexpr size_t TAG_SIZE = 4;
+		if (rc != SesameBLETransport::decode_result_t::received ||
+		    transport.data_size() != 2 + 2 + login_pk.size() + Sesame::TOKEN_SIZE + TAG_SIZE) {
+			return false;
+		}
+		const std::byte* req = transport.data() + 2;
+		std::array<std::byte, Sesame::TOKEN_SIZE> local_tok;
+		std::copy(req + 2, req + 2 + login_pk.size(), login_pk.begin());
+		std::copy(req + 2 + login_pk.size(), req + 2 + login_pk.size() + local_tok.size(), local_tok.begin());
+		CmacAes128 cmac;
+		std::array<std::byte, 16> tag;
+		if (!cmac.set_key(secret) || !cmac.update(req, 2 + login_pk.size() + local_tok.size()) || !cmac.update(tok) ||
+		    !cmac.finish(tag) || !std::equal(tag.cbegin(), tag.cbegin() + TAG_SIZE, req + 2 + login_pk.size() + local_tok.size())) {
+			return false;
+		}
+		std::array<std::byte, Ecc::SK_SIZE> shared;
+		std::array<std::byte, 16> key;
+		if (!ecc.ecdh(login_pk, shared)) {
+			return false;
+		}
+		std::copy(shared.cbegin(), shared.cbegin() + key.size(), key.begin());
+		if (!cmac.set_key(key) || !cmac.update(local_tok) || !cmac.update(tok) || !cmac.finish(key) ||
+		    !crypt.set_session_key(key.data(), key.size(), local_tok, tok)) {
+			return false;
+		}
+		Sesame::response_login_t resp{};
+		resp.op_code_2 = 2;
+		resp.result = Sesame::result_code_t::success;
+		if (!transport.send_notify(Sesame::op_code_t::response, Sesame::item_code_t::login, reinterpret_cast<const std::byte*>(&resp),
+		                           sizeof(resp), true, crypt)) {
+			return false;
+		}
+		deliver(client);
+		bool active = client.is_session_active();
+		client.on_disconnected();
+		return active;
+	}
+
+	static void deliver(libsesame3bt::core::SesameClientCore& client) {
+		for (; !to_client.empty(); to_client.head++) {
+			auto i = to_client.head % loopback_queue_t::SLOTS;
+			client.on_received(reinterpret_cast<const std::byte*>(to_client.frames[i]), to_client.sizes[i]);
+		}
+	}
+};
+
+}  // namespace
+
+void
+test_os2_shared_secret_reuse() {
+	using libsesame3bt::core::SesameClientCore;
+	loopback_client_backend_t backend;
+	SesameClientCore client{backend};
+	os2_peer_t peer;
+	TEST_ASSERT_TRUE(peer.begin());
+	TEST_ASSERT_TRUE(client.begin(Sesame::model_t::sesame_3));
+	TEST_ASSERT_TRUE(client.set_keys(libsesame3bt::core::util::bin2hex(peer.pk), libsesame3bt::core::util::bin2hex(peer.secret)));
+
+	// lifetime 0: reused regardless of time, up to max_reuse logins
+	client.set_shared_secret_reuse(2, 0);
+	backend.now = 1000;
+	TEST_ASSERT_TRUE(peer.login(client));
+	auto first = peer.login_pk;
+	backend.now += 0x7fff'ffff;
+	TEST_ASSERT_TRUE(peer.login(client));
+	TEST_ASSERT_TRUE(peer.login_pk == first);
+	backend.now += 0x7fff'ffff;
+	TEST_ASSERT_TRUE(peer.login(client));
+	TEST_ASSERT_TRUE(peer.login_pk == first);
+	TEST_ASSERT_TRUE(peer.login(client));
+	TEST_ASSERT_TRUE(peer.login_pk != first);
+	TEST_ASSERT_EQUAL(2, client.get_shared_secret_reuse_count());
+
+	// reused within the lifetime, fresh login once it expired (clock wraps around)
+	client.set_shared_secret_reuse(100, 1000);
+	backend.now = 0xffff'ff00;
+	TEST_ASSERT_TRUE(peer.login(client));
+	first = peer.login_pk;
+	backend.now += 999;
+	TEST_ASSERT_TRUE(peer.login(client));
+	TEST_ASSERT_TRUE(peer.login_pk == first);
+	backend.now += 1;
+	TEST_ASSERT_TRUE(peer.login(client));
+	TEST_ASSERT_TRUE(peer.login_pk != first);
+	TEST_ASSERT_EQUAL(3, client.get_shared_secret_reuse_count());
+
+	// lifetime cannot be checked without clock
+	backend.has_clock = false;
+	TEST_ASSERT_TRUE(peer.login(client));
+	first = peer.login_pk;
+	TEST_ASSERT_TRUE(peer.login(client));
+	TEST_ASSERT_TRUE(peer.login_pk != first);
+	TEST_ASSERT_EQUAL(3, client.get_shared_secret_reuse_count());
+}
+
+void
+test_os2_restartable_handshake() {
+	using libsesame3bt::core::SesameClientCore;
+	loopback_client_backend_t backend;
+	SesameClientCore client{backend};
+	os2_peer_t peer;
+	TEST_ASSERT_TRUE(peer.begin());
+	TEST_ASSERT_TRUE(client.begin(Sesame::model_t::sesame_3));
+	TEST_ASSERT_TRUE(client.set_keys(libsesame3bt::core::util::bin2hex(peer.pk), libsesame3bt::core::util::bin2hex(peer.secret)));
+
+	// whole handshake on the initial message
+	TEST_ASSERT_TRUE(peer.login(client));
+	TEST_ASSERT_EQUAL(0, peer.updates);
+	auto fresh = peer.login_pk;
+
+	// key pair and ECDH run in steps from update(), the peer accepts the same tag and session key
+	client.set_restartable_handshake(true);
+	for (int i = 0; i < 2; i++) {
+		TEST_ASSERT_TRUE(peer.login(client));
+		TEST_ASSERT_GREATER_OR_EQUAL(2, peer.updates);
+		TEST_ASSERT_TRUE(peer.login_pk != fresh);
+		fresh = peer.login_pk;
+	}
+}
+
+void
+test_os2_handshake_precompute() {
+	using libsesame3bt::core::SesameClientCore;
+	loopback_client_backend_t backend;
+	SesameClientCore client{backend};
+	os2_peer_t peer;
+	TEST_ASSERT_TRUE(peer.begin());
+	TEST_ASSERT_TRUE(client.begin(Sesame::model_t::sesame_3));
+	TEST_ASSERT_TRUE(client.set_keys(libsesame3bt::core::util::bin2hex(peer.pk), libsesame3bt::core::util::bin2hex(peer.secret)));
+
+	// restartable handshake tells precomputed logins (no update() needed) from computed ones
+	client.set_restartable_handshake(true);
+	client.set_handshake_precompute(true);
+	std::array<std::byte, libsesame3bt::core::Ecc::PK_SIZE> last{};
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 10000; j++) {
+			client.update();
+		}
+		TEST_ASSERT_TRUE(peer.login(client));
+		TEST_ASSERT_EQUAL(0, peer.updates);
+		TEST_ASSERT_TRUE(peer.login_pk != last);
+		last = peer.login_pk;
+	}
+	// pool used up, computed on demand
+	TEST_ASSERT_TRUE(peer.login(client));
+	TEST_ASSERT_GREATER_OR_EQUAL(2, peer.updates);
+	TEST_ASSERT_TRUE(peer.login_pk != last);
+}
+
+// RFC 5903 8.1 (ECDH with P-256)
+void
+test_ecdh_kat() {
+	using libsesame3bt::core::Ecc;
+	using libsesame3bt::core::util::hex2bin;
+	std::array<std::byte, Ecc::SK_SIZE> i, z, shared;
+	std::array<std::byte, Ecc::PK_SIZE> gi, gr, pk;
+	TEST_ASSERT_TRUE(hex2bin("c88f01f510d9ac3f70a292daa2316de544e9aab8afe84049c62a9c57862d1433", i));
+	TEST_ASSERT_TRUE(hex2bin("dad0b65394221cf9b051e1feca5787d098dfe637fc90b9ef945d0c3772581180"
+	                         "5271a0461cdb8252d61f1c456fa3e59ab1f45b33accf5f58389e0577b8990bb3",
+	                         gi));
+	TEST_ASSERT_TRUE(hex2bin("d12dfb5289c8d4f81208b70270398c342296970a0bccb74c736fc7554494bf63"
+	                         "56fbf3ca366cc23e8157854c13c58d6aac23f046ada30f8353e74f33039872ab",
+	                         gr));
+	TEST_ASSERT_TRUE(hex2bin("d6840f6b42f6edafd13116e0e12565202fef8e9ece7dce03812464d04b9442de", z));
+	Ecc ecc;
+#if defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+	allocations = 0;
+	count_allocations = true;
+#endif
+	TEST_ASSERT_TRUE(ecc.load_key(i));
+	TEST_ASSERT_TRUE(ecc.export_pk(pk));
+	TEST_ASSERT_EQUAL_MEMORY(gi.data(), pk.data(), pk.size());
+	TEST_ASSERT_TRUE(Ecc::check_pk(gr));
+	TEST_ASSERT_TRUE(ecc.ecdh(gr, shared));
+	TEST_ASSERT_EQUAL_MEMORY(z.data(), shared.data(), shared.size());
+	gr[Ecc::PK_SIZE - 1] ^= std::byte{1};
+	TEST_ASSERT_FALSE(Ecc::check_pk(gr));
+	TEST_ASSERT_FALSE(ecc.ecdh(gr, shared));
+#if defined(LIBSESAME3BTCORE_ECC_BUILTIN)
+	count_allocations = false;
+	TEST_ASSERT_EQUAL(0, allocations);
+#endif
+}
+
 void
 test_restart_while_disconnected() {
 	NimBLEDevice::init("");
@@ -153,9 +920,22 @@ setup() {
 	delay(3000);
 	UNITY_BEGIN();
 #if TEST_UTILITY
+	RUN_TEST(test_random_array);
 	RUN_TEST(test_truncate_utf8);
 	RUN_TEST(test_cleanup_tail_utf8);
 	RUN_TEST(test_vol_pct);
+	RUN_TEST(test_ccm_kat);
+	RUN_TEST(test_iv_resync);
+	RUN_TEST(test_cmac_kat);
+	RUN_TEST(test_transport_timing);
+	RUN_TEST(test_tx_queue);
+	RUN_TEST(test_buffer_pool);
+	RUN_TEST(test_os3_login_without_heap);
+	RUN_TEST(test_server_recv_buffers);
+	RUN_TEST(test_os2_shared_secret_reuse);
+	RUN_TEST(test_os2_restartable_handshake);
+	RUN_TEST(test_os2_handshake_precompute);
+	RUN_TEST(test_ecdh_kat);
 #endif
 #if TEST_BLE
 	RUN_TEST(test_restart_while_disconnected);